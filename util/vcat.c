@@ -0,0 +1,263 @@
+/********************************************************
+** vcat.c - USB directory catalog cache
+**
+** These routines keep the size and date details of the
+** current USB directory in a small binary file on the
+** local default drive.  When the same directory of the
+** same volume is listed again the details are read back
+** from the file instead of issuing a DIR and a DIRT
+** command for every entry.
+**
+** The cache is keyed by three 16-bit checksums: one over
+** the monitor's IDDE reply (volume label and serial number,
+** see vidsum() in VINC), one over the directory's path and
+** one over the names in the directory listing.  If any
+** differs, or the entry count does, the cache is ignored
+** and rebuilt.  The path is the one VINC is tracking (see
+** vcwd), or "/" for a listing without a ".." entry, which
+** only the root has.  If neither tells where the listing
+** came from, the cache isn't used, since two directories
+** may hold the same names.  A file rewritten in place
+** under the same name by another machine is not detected,
+** so programs that write to the stick call catdel() and
+** VDIR has a switch to bypass the cache.
+**
+** catload(), catsave() and catkey() work on the calling
+** program's directory array, passed as tab and n:
+**
+**	struct finfo *tab[];
+**	int n;
+**
+** with struct finfo starting with the fields below.  The
+** caller may add fields of its own after them.  catdel()
+** needs no array, so programs that only write to the
+** stick can link this file too.
+**
+** The following routines are defined here:
+**
+**  catload()
+**  catsave()
+**  catdel()
+**  catkey()
+**
+** This code is designed for use with the Software Toolworks C/80
+** v. 3.1 compiler with the optional support for
+** floats and longs.  The compiler should be configured
+** to produce a Microsoft relocatable module (.REL file)
+** file which can (optionally) be stored in a library
+** (.LIB file) using the Microsoft LIB-80 Library Manager.
+** The Microsoft LINK-80 loader program is then used to
+** link this code, along with any other required modules,
+** with the main (calling) program.
+**
+********************************************************/
+#include "fprintf.h"
+
+#define	TRUE	1
+#define	FALSE	0
+#define	NUL	'\0'
+
+/* name of the cache file on the default drive */
+#define	CATFILE		"VDIRCAT.DAT"
+#define	CATMAGIC	0x4357		/* changed with the layout */
+
+/* directory entry, leading fields of the caller's */
+struct finfo {
+	char name[9];
+	char ext[4];
+	int isdir;
+	long size;
+	unsigned mdate;
+	unsigned mtime;
+	char tag;
+};
+
+/* current directory (declared in vinc library) */
+extern char vcwd[];
+extern int vcwdok;
+
+/* cache file header */
+struct cathdr {
+	unsigned magic;
+	unsigned volsum;		/* checksum of IDDE reply */
+	unsigned dirsum;		/* checksum of directory path */
+	unsigned namesum;		/* checksum of entry names */
+	int n;					/* number of entries */
+} chdr;
+
+/* details kept for each entry, in listing order */
+struct catrec {
+	long size;
+	unsigned mdate;
+	unsigned mtime;
+} crec;
+
+/* key of the directory currently in memory */
+unsigned catvol, catdir, catnam;
+int catkeyok;
+int catdirok;		/* TRUE if its path is known */
+
+/********************************************************
+**
+** catkey
+**
+** Compute the cache key for the directory in memory: the
+** volume checksum from vidsum(), a checksum over its path
+** and one over the entry names.  Costs one monitor
+** command.  catdirok is left FALSE if the path isn't
+** known.
+**
+********************************************************/
+catkey(tab, n)
+struct finfo *tab[];
+int n;
+{
+	int i, isroot;
+	char *c;
+
+	catvol = vidsum();
+
+	/* only the root has no ".." entry */
+	isroot = TRUE;
+	for (i=0; i<n; i++)
+		if (tab[i]->isdir && (strcmp(tab[i]->name, "..") == 0))
+			isroot = FALSE;
+
+	catdirok = TRUE;
+	if (vcwdok)
+		c = vcwd;
+	else if (isroot)
+		c = "/";
+	else {
+		c = "";
+		catdirok = FALSE;
+	}
+	for (catdir=0; *c!=NUL; c++)
+		catdir = ((catdir << 1) | (catdir >> 15)) + *c;
+
+	catnam = 0;
+	for (i=0; i<n; i++) {
+		for (c=tab[i]->name; *c!=NUL; c++)
+			catnam = ((catnam << 1) | (catnam >> 15)) + *c;
+		for (c=tab[i]->ext; *c!=NUL; c++)
+			catnam = ((catnam << 1) | (catnam >> 15)) + *c;
+		catnam += tab[i]->isdir;
+	}
+	catkeyok = TRUE;
+}
+
+/********************************************************
+**
+** catload
+**
+** Fill in size and date for every entry from the cache
+** file, if the file matches the directory in memory.
+**
+** Returns:
+**		0	details loaded
+**		-1	no cache, it does not match, or the path of
+**			the directory isn't known
+**
+********************************************************/
+catload(tab, n)
+struct finfo *tab[];
+int n;
+{
+	int i, channel, rc;
+
+	catkey(tab, n);
+	if (!catdirok)
+		return -1;
+
+	if ((channel = fopen(CATFILE, "rb")) == 0)
+		return -1;
+
+	rc = -1;
+	if ((read(channel, &chdr, sizeof(chdr)) == sizeof(chdr)) &&
+		(chdr.magic == CATMAGIC) &&
+		(chdr.volsum == catvol) &&
+		(chdr.dirsum == catdir) &&
+		(chdr.namesum == catnam) &&
+		(chdr.n == n)) {
+		for (i=0; i<n; i++) {
+			if (read(channel, &crec, sizeof(crec)) != sizeof(crec))
+				break;
+			tab[i]->size  = crec.size;
+			tab[i]->mdate = crec.mdate;
+			tab[i]->mtime = crec.mtime;
+		}
+		if (i == n)
+			rc = 0;
+	}
+	fclose(channel);
+
+	return rc;
+}
+
+/********************************************************
+**
+** catsave
+**
+** Write the size and date of every entry in memory to the
+** cache file.  The caller must have looked up all of them.
+** Nothing is written if the path of the directory isn't
+** known.
+**
+** Returns:
+**		0	Success
+**		-1	Error, or not saved
+**
+********************************************************/
+catsave(tab, n)
+struct finfo *tab[];
+int n;
+{
+	int i, channel, rc;
+
+	if (!catkeyok)
+		catkey(tab, n);
+	if (!catdirok)
+		return -1;
+
+	if ((channel = fopen(CATFILE, "wb")) == 0)
+		return -1;
+
+	chdr.magic   = CATMAGIC;
+	chdr.volsum  = catvol;
+	chdr.dirsum  = catdir;
+	chdr.namesum = catnam;
+	chdr.n       = n;
+	rc = 0;
+	if (write(channel, &chdr, sizeof(chdr)) == -1)
+		rc = -1;
+
+	for (i=0; (i<n) && (rc==0); i++) {
+		crec.size  = tab[i]->size;
+		crec.mdate = tab[i]->mdate;
+		crec.mtime = tab[i]->mtime;
+		if (write(channel, &crec, sizeof(crec)) == -1)
+			rc = -1;
+	}
+	fclose(channel);
+
+	/* don't leave a partial cache behind */
+	if (rc == -1)
+		catdel();
+
+	return rc;
+}
+
+/********************************************************
+**
+** catdel
+**
+** Remove the cache file.  Called by programs that have
+** written to the stick, and by VLOG after writing a log
+** there.
+**
+********************************************************/
+catdel()
+{
+	unlink(CATFILE);
+	catkeyok = FALSE;
+}
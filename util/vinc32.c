@@ -37,35 +37,175 @@
 **  out_v()
 **  in_vwait()
 **  out_vwait()
+**  in_vms()
+**  vgetc()
+**  vputc()
+**  vinblk()
+**  voutblk()
+**  vintr()
+**  vpoll()
+**  vticks()
+**  vtron()
+**  vtrdump()
+**  vstclr()
 **  vfind_disk()
 **  vpurge()
 **  vhandshake()
+**  vecho()
 **  vinit()
 **  vsync()
 **  vdirf()
 **  vdird()
+**  vdnone()
+**  vdirq()
+**  vdira()
 **  vprompt()
 **  vropen()
 **  vwopen()
 **  vseek()
+**  vlseek()
 **  vclose()
+**  vdel()
+**  vmkd()
+**  vqclose()
+**  vsettle()
 **  vclf()
+**  vsnone()
 **  vipa()
+**  viph()
+**  vmode()
+**  vcmd()
+**  visprompt()
+**  viscf()
+**  vlist()
+**  vidsum()
+**  vrdbin()
 **  vread()
 **  vwrite()
+**  vwflush()
+**  vrdf()
+**  vwrf()
+**  vpread()
+**  vnum()
+**  vrdstart()
+**  vrdblk()
+**  vrdend()
+**  vwrstart()
+**  vwrblk()
+**  vwrend()
 **  vcd()
 **  vcdroot()
 **  vcdup()
+**  vcdabs()
+**  vcdpath()
+**  vcwdld()
+**  vcwdsv()
 **
 ** The typical calling sequence is as follows: vinit() is
 ** called first to ensure communication and put the device
 ** in a known state, then vfind_disk() is used to ensure that
 ** a storage device is attached.  Directory level can be
-** changed with vcd() and vcdroot(). Files can then be opened
+** changed with vcd() and vcdroot(), or with vcdpath() which
+** takes a whole path. Files can then be opened
 ** with vropen() or vwopen(); I/O operations performed with
 ** vread(), vwrite(), and vseek(); and finally closed with
 ** vclose();
 **
+** vread() and vwrite() work in whole 512 byte sectors of
+** the file where they can, since the flash drive does: a
+** WRF that covers part of a sector makes the VNC1L read,
+** patch and rewrite it.  vwrite() output is collected up
+** to each sector boundary (whole sectors go straight out)
+** and the tail is written by vwflush(), which vclose() and
+** vseek() call.  vread() reads up to the next sector
+** boundary and keeps what the caller didn't ask for, as
+** long as the file size is known, i.e. the file was looked
+** up with vdirf() before vropen().
+**
+** vrdf() and vwrf() send exactly one RDF or WRF command
+** for the bytes given, for callers that size their own
+** blocks (VBENCH measures the raw commands with them).
+** They skip the buffers of vread() and vwrite(), so don't
+** mix them with those on one open file without a vlseek().
+**
+** Records can be read from anywhere in a file opened for
+** reading with vpread(), which takes a long offset.  It
+** keeps the last few 512 byte blocks it read in a small
+** cache (allocated on first use) so that repeated and
+** nearby reads don't go to the device.
+**
+** VINC keeps track of which file the monitor has open,
+** where its file pointer is and the protocol mode, and
+** leaves out commands that wouldn't change them: the
+** "safety" close before an open when nothing is open, a
+** seek to where the pointer already is, and a repeated
+** mode change.  After any command fails the state is taken
+** as unknown and the next open closes first, as before.
+**
+** The sizes and dates of many files are best looked up
+** with vdirq() and vdira(), which keep the next file's DIR
+** and DIRT commands queued in the VDIP while the host reads
+** the replies for the current one.
+**
+** Whole files are best moved with the streaming routines:
+** vrdstart() or vwrstart() issue a single RDF or WRF command
+** for the entire file, the data is then passed in blocks of
+** any convenient size with vrdblk() or vwrblk(), and vrdend()
+** or vwrend() collects the one prompt at the end.  This avoids
+** a command and prompt round trip for every block.
+**
+** The VDIP and the local disk can also be kept busy at the
+** same time by not waiting for the monitor to finish a
+** slow command.  vqclose() sends CLF and returns at once;
+** the prompt it owes is collected by the next command (or
+** by vsettle()), so the local file can be closed and the
+** next one opened while the monitor updates the flash
+** drive's directory.  Likewise a caller should issue
+** vrdstart() before creating the local file, so the monitor
+** is already filling the FIFO meanwhile.
+**
+** Normally the monitor is driven with its extended (ECS)
+** command set and ASCII (IPA) numbers.  If the caller sets
+** vcompact to TRUE before calling vinit() the monitor is
+** instead switched to the Short Command Set with binary
+** (IPH) numbers: commands go out as single byte opcodes,
+** 32-bit arguments as 4 raw bytes and directory replies
+** come back in binary, which saves both FIFO bytes and
+** parsing.  All routines here hide the difference; callers
+** that read monitor replies themselves should use
+** visprompt() and viscf() rather than comparing strings.
+**
+** All port I/O goes through vgetc(), vputc(), vinblk() and
+** voutblk().  They normally poll the VDIP status port, but
+** if this file is compiled with VINTR defined and the
+** caller has set up the USB board's interrupt with vintr(),
+** they work from the receive and transmit rings kept by the
+** interrupt routine in VINT (which must then be linked).
+** The caller must call vpoll() before it exits.  This is
+** only supported on CP/M 2.2: a banked CP/M 3 BIOS
+** switches page zero away during disk I/O, and HDOS ends a
+** program on ^C at any moment, leaving the vector to it.
+**
+** The library counts, in longs that a caller may read, the
+** bytes moved each way (vrxbyt, vtxbyt), the monitor
+** commands sent (vncmd) and the status polls spent waiting
+** for the VDIP to have a byte (vrxspn) or take one
+** (vtxspn).  Many polls per byte mean the VNC1L or the
+** flash drive is the bottleneck, few mean the host is.
+** Only the waiting paths count polls, so a transfer that
+** never waits costs just the byte totals per block.
+** vstclr() resets them.
+**
+** Compiled with VTRACE defined, the library can also keep
+** a trace of the last VTRN monitor commands once vtron()
+** has been called: when each was started, when its sending
+** was done (the first read after it), when the first reply
+** byte came in and when the prompt did.  vtrdump() prints
+** the trace and the total time spent in each phase.  The
+** stamps come from vticks(), so on CP/M 3 they are only
+** good to a second and mean something only over many
+** commands.
+**
 ** This code is designed for use with the Software Toolworks C/80
 ** v. 3.1 compiler with the optional support for
 ** floats and longs.  The compiler should be configured
@@ -96,11 +236,28 @@
 */
 #define CPM3	1
 
+/* Define VINTR to build in the interrupt-driven ring
+** support (see vintr() and VINT).
+*/
+/* #define VINTR	1 */
+
+/* Define VTRACE to build in the command trace (see vtron()).
+*/
+/* #define VTRACE	1 */
+
 /* *** OS-independent definitions *** */
 
 /* default max time (sec) to wait for response */
 #define	MAXWAIT	5
 
+/* startup synchronization (milliseconds): quiet time that
+** ends a purge, first handshake timeout and the limit for
+** the exponential backoff of that timeout.
+*/
+#define	DRAINMS	10
+#define	SYNCMS	4
+#define	SYNCMAX	4096
+
 #define	TRUE	1
 #define	FALSE	0
 #define	NUL	'\0'
@@ -113,6 +270,31 @@
 #define PROMPT	"D:\\>"
 #define CFERROR "Command Failed"
 
+/* Short Command Set (SCS) prompt and error */
+#define SPROMPT	">"
+#define SCFERROR "CF"
+
+/* Short Command Set opcodes */
+#define S_DIR	0x01
+#define S_CD	0x02
+#define S_MKD	0x06
+#define S_DLF	0x07
+#define S_WRF	0x08
+#define S_OPW	0x09
+#define S_CLF	0x0A
+#define S_RDF	0x0B
+#define S_OPR	0x0E
+#define S_SCS	0x10
+#define S_ECS	0x11
+#define S_SEK	0x28
+#define S_DIRT	0x2F
+#define S_IPA	0x90
+#define S_IPH	0x91
+#define S_IDDE	0x94
+
+/* CP/M end of file marker, used to pad short WRF streams */
+#define	CPMEOF	0x1A
+
 /* time/date hex value (shared global */
 char td_string[15];
 
@@ -128,13 +310,103 @@ union u_fil {
 /* I/O line buffer 		*/
 char linebuff[128];	
 
+/* bytes remaining in the current RDF or WRF stream */
+long vleft;
+
+/* sector coalescing for vread() and vwrite() */
+#define	VSECT	512
+char vwbuf[VSECT];	/* output waiting for a sector boundary */
+int vwfill;
+char vrbuf[VSECT];	/* input read up to a sector boundary */
+int vrlen, vrnext;	/* bytes in vrbuf, next one to hand out */
+long vfpos;			/* file pointer as the monitor has it */
+long vrsize;		/* size of the file open for read, -1 unknown */
+long vrleft;		/* bytes after vfpos, -1 unknown */
+/* files queued by vdirq() awaiting vdira() */
+int vdqn;
+
+/* last file sized by vdirf(), for vropen() and vwopen().
+** Anything that may change the file or where it is (a
+** write, a close after writing, a delete, a CD, a resync)
+** empties vdname, so a stale size is never used.
+*/
+char vdname[13];
+long vdsize;
+
+/* block cache for vpread() */
+#define	VNBLK	4
+char *vcdata;		/* VNBLK blocks of VSECT bytes */
+long vcpos[VNBLK];	/* file offset of each block, -1 if none */
+int vclen[VNBLK];	/* bytes held (less at end of file) */
+unsigned vcuse[VNBLK];	/* vcclk at last use */
+unsigned vcclk;
+
+/* TRUE when using the Short Command Set and binary numbers */
+int vcompact;
+
+/* transfer counters, see vstclr() */
+long vrxspn;		/* status polls waiting for RXF */
+long vtxspn;		/* status polls waiting for TXE */
+long vrxbyt;		/* bytes read from the VDIP */
+long vtxbyt;		/* bytes written to the VDIP */
+long vncmd;			/* monitor commands sent */
+
+/* TRUE while the monitor owes a prompt (see vqclose()) and
+** TRUE if such a prompt, once collected, was an error
+*/
+int vpend;
+int vperr;
+
+/* what the monitor is known to have open, so that commands
+** which can't change anything are left out (see vsnone())
+*/
+#define	VS_UNK		-1		/* not known: close before the next open */
+#define	VS_NONE		0		/* no file open */
+#define	VS_READ		1		/* open for read by vropen() */
+#define	VS_WRITE	2		/* open for write by vwopen() */
+int vsopen;
+char vsname[13];	/* the file open */
+int vfposok;		/* TRUE if the monitor's pointer is at vfpos */
+int vsmode;			/* protocol mode set by vmode(), -1 unknown */
+
+/* current directory, see vcdabs() */
+#define	VPATH	64
+char vcwd[VPATH];	/* e.g. "/GAMES/ZORK", "/" at the root */
+int vcwdok;			/* TRUE if vcwd is known */
+
+/* what vcwdsv() keeps between runs */
+struct cwdfil {
+	unsigned volsum;	/* vidsum() of the volume */
+	char path[VPATH];
+} vcwdf;
+
+#ifdef VTRACE
+/* command trace ring: times (low 16 bits of vticks()) at
+** which each command was started, finished sending, got
+** its first reply byte and got its prompt; vtseen has a
+** bit for each of the last three that happened.
+*/
+#define	VTRN	32
+char vtname[VTRN*4];
+unsigned vtt0[VTRN], vtsent[VTRN], vtfrst[VTRN], vtdone[VTRN];
+char vtseen[VTRN];
+int vthead;		/* next slot to use */
+int vtcur;		/* slot of the latest command */
+int vtcnt;		/* commands traced since vtron() */
+int vton;		/* TRUE when tracing */
+int vtopen;		/* TRUE until the latest command's prompt */
+int vtstat;		/* 1 sending, 2 awaiting first byte, else 0 */
+#endif
+
+#ifdef VINTR
+/* TRUE while the interrupt rings are in use */
+int viring;
+#endif
+
 /* USB i/o ports (defined in calling program )*/
 extern int p_data;		/* USB data port */
 extern int p_stat;		/* USB status port */
 
-/* template for non-int function */
-char *itoa();
-
 /* *** OS-dependent definitions *** */
 
 #ifdef CPM3
@@ -170,6 +442,12 @@ struct timedate {
 /* pointer to the one-second tick counter in CP/M 3 */
 char *secp;
 
+/* CP/M 3 has no millisecond clock, so short waits count
+** status port polls instead.  This is the approximate
+** number of polls per millisecond on a 2 MHz Z80.
+*/
+#define	SPINMS	16
+
 #endif
 
 /* "tick" counter style clock is used only for CP/M 2.2 and 
@@ -214,8 +492,13 @@ char *s;
 #endif
 	rc = 0;
 
-	for (c=s; ((*c!=0) && (rc!=-1)); c++)
-		rc = out_vwait(*c, MAXWAIT);
+	/* the first byte is sent with a timeout to catch a
+	** dead device, the rest go out as a block.
+	*/
+	c = s;
+	if (*c != 0)
+		if ((rc = out_vwait(*c++, MAXWAIT)) != -1)
+			voutblk(c, strlen(c));
 	
 	return rc;
 }
@@ -280,17 +563,8 @@ char tchar;
 ********************************************************/
 in_v()
 {
-	int b;
-	
-	/* check for Data Ready */
-	if ((inp(p_stat) & VRXF) != 0) {
-		/* read the character from the port and return it */
-		b = inp(p_data);
-		return b;
-	}
-	else
-		/* return -1 if no data available */
-		return -1;
+	/* return the character, or -1 if no data available */
+	return vgetc();
 }
 
 /********************************************************
@@ -304,11 +578,9 @@ in_v()
 out_v(c)
 char c;
 {
-	/* Wait for ok to transmit (VTXE high) */
-	while ((inp(p_stat) & VTXE) == 0)
+	/* Wait until the character is taken */
+	while (vputc(c) == -1)
 		;
-	/* OK to transmit the character */
-	outp(p_data,c);
 }
 
 
@@ -318,7 +590,8 @@ char c;
 **
 ** "Input with Wait" - Input a character from the VDIP1 but 
 ** detect hung conditions by monitoring the time. Wait no 
-** longer than t seconds.
+** longer than t seconds.  The clock is only read once the
+** VDIP has kept us waiting.
 **
 ** Returns:
 **		Character read if successful
@@ -328,12 +601,21 @@ char c;
 in_vwait(t)
 int t;
 {
+	int c;
+#ifdef CPM3
+	int snapshot, countdown;
+#else
+	unsigned timeout;
+#endif
+	
+	/* usually the byte is already there */
+	if ((c = vgetc()) != -1)
+		return c;
+	
 #ifdef CPM3	
 /* CPM3 maintains a one second counter and that's how we
 ** mark time.
 */	
-	int snapshot, countdown;
-
 	for(countdown=t; countdown > 0; --countdown) {
         /* snapshot the real time clock seconds count */
 		snapshot = *secp;
@@ -342,8 +624,9 @@ int t;
 			/* check for port activity and if so
 			** then read the data and return
 			*/
-			if (inp(p_stat) & VRXF)
-				return inp(p_data);
+			if ((c = vgetc()) != -1)
+				return c;
+			vrxspn++;
 		}
 		/* if we get to here it means the clock
 		** ticked one second. Continue until the
@@ -355,8 +638,6 @@ int t;
 /* CPM2.2 and HDOS maintain a 2ms "tick" timer at Ticptr 
 ** and that's how we mark time for those systems.
 */
-	unsigned timeout;
-	
 	/* time (t) is in seconds but we want to convert
 	** that to units of 2 ms so we multiply by 512 = 2^9
 	** (close enough to 500 for our purposes ...)
@@ -367,8 +648,9 @@ int t;
 		/* check for Data Ready and if so then
 		** read the data and return
 		*/
-		if (inp(p_stat) & VRXF)
-			return inp(p_data);
+		if ((c = vgetc()) != -1)
+			return c;
+		vrxspn++;
 	}
 #endif
 
@@ -385,7 +667,8 @@ int t;
 **
 ** Send a character to the VDIP1 via the specified port,
 ** but detect hung conditions by monitoring the time.
-** Wait no more than t seconds.
+** Wait no more than t seconds.  As in in_vwait() the
+** clock is only read if the VDIP isn't ready.
 **
 ** Returns:
 **		0	if successful
@@ -396,12 +679,20 @@ out_vwait(c,t)
 char c;
 int t;
 {
+#ifdef CPM3
+	int snapshot, countdown;
+#else
+	unsigned timeout;
+#endif
+	
+	/* usually the VDIP can take it at once */
+	if (vputc(c) != -1)
+		return 0;
+	
 #ifdef CPM3	
 /* CPM3 maintains a one second counter and that's how we
 ** mark time.
 */	
-	int snapshot, countdown;
-
 	for(countdown=t; countdown > 0; --countdown) {
         /* snapshot the real time clock seconds count */
 		snapshot = *secp;
@@ -410,10 +701,9 @@ int t;
 			/* check for ok to transmit (VTXE high)
 			** and if so then transmit and finish
 			*/
-			if (inp(p_stat) & VTXE) {
-				outp(p_data,c);
+			if (vputc(c) != -1)
 				return 0;
-			}
+			vtxspn++;
 		}
 		/* if we get to here it means the clock
 		** ticked one second. Continue until the
@@ -425,8 +715,6 @@ int t;
 /* CPM2.2 and HDOS maintain a 2ms "tick" timer at Ticptr 
 ** and that's how we mark time for those systems.
 */
-	unsigned timeout;
-	
 	/* time (t) is in seconds but we want to convert
 	** that to units of 2 ms so we multiply by 512 = 2^9
 	** (close enough to 500 for our purposes ...)
@@ -437,10 +725,9 @@ int t;
 		/* check for OK to transmit and if so then
 		** transmit and finish
 		*/
-		if (inp(p_stat) & VTXE) {
-			outp(p_data,c);
+		if (vputc(c) != -1)
 			return 0;
-		}
+		vtxspn++;
 	}
 #endif
 
@@ -454,543 +741,2188 @@ int t;
 
 /********************************************************
 **
-** vfind_disk
+** in_vms
 **
-** Determine if there is a flash drive available on the
-** USB port. 
+** Input a character from the VDIP1, waiting no longer
+** than ms milliseconds.  Used for the short waits of the
+** startup synchronization.  On CP/M 3 the time is counted
+** in status polls (see SPINMS) and is only approximate.
 **
+** Returns:
+**		Character read if successful
+**		-1 if timed out
 **
 ********************************************************/
-vfind_disk()
+in_vms(ms)
+unsigned ms;
 {
-	/* If there is a drive available then a \r will cause 
-	** the prompt to come back, so simply send \r and 
-	** then test for a command prompt...
-	*/
-	str_send("\r");
+	int c;
+#ifdef CPM3
+	int spins;
 	
-	return vprompt();
+	for (; ms > 0; --ms)
+		for (spins=SPINMS; spins > 0; --spins)
+			if ((c = vgetc()) != -1)
+				return c;
+#else
+	unsigned timeout;
+	
+	/* 2 ms per tick, round up */
+	timeout = *Ticptr + ((ms + 1) >> 1);
+	
+	while (*Ticptr != timeout)
+		if ((c = vgetc()) != -1)
+			return c;
+#endif
+
+	return -1;
 }
 
 /********************************************************
 **
-** vpurge
+** vgetc
 **
-** Read all the pending data from the VDIP device and 
-** throw it away.  Wait for up to 1 second each time
-** before deciding we're done. 
+** Take a byte from the VDIP if one is ready.
+**
+** Returns:
+**		Character read if successful
+**		-1 if none available
 **
 ********************************************************/
-vpurge()
+vgetc()
 {
+#ifdef VINTR
 	int c;
-	
-	do {
-		c = in_vwait(1);
-	} while (c != -1);
+#endif
+
+#ifdef VTRACE
+	if (vtstat)
+		return vtgetc();
+#endif
+#ifdef VINTR
+	if (viring) {
+		if ((c = rxget()) != -1)
+			vrxbyt++;
+		return c;
+	}
+#endif
+	if (inp(p_stat) & VRXF) {
+		vrxbyt++;
+		return inp(p_data);
+	}
+	return -1;
 }
 
 /********************************************************
 **
-** vhandshake
+** vputc
 **
-** This routine checks to see if two-way communication with 
-** the VDIP Command Monitor is working. It sends an ASCII 'E'
-** and waits up to MAXWAIT for the 'E' to be echoed back.
+** Send the byte c to the VDIP if it can take it.
 **
 ** Returns:
-**		0	Success
-**		-1	Error, timed out or no response
+**		0 if sent
+**		-1 if not ready
 **
 ********************************************************/
-vhandshake()
+vputc(c)
+char c;
 {
-	int rc;
-	
-	/* Attempt to send an "E" */
-	if (str_send("E\r") == -1)
-		/* time out on send! */
-		rc = -1;
-	else if (str_rdw(linebuff, '\r') == -1)
-		/* time out on reading response! */
-		rc = -1;
-	else if (strcmp(linebuff,"E") != 0)
-		/* wrong response! */
-		rc = -1;
-	else
-		/* success! */
-		rc = 0;
-
-	return rc;
+#ifdef VINTR
+	if (viring) {
+		if (txput(c) == -1)
+			return -1;
+		vtxbyt++;
+		return 0;
+	}
+#endif
+	if ((inp(p_stat) & VTXE) == 0)
+		return -1;
+	outp(p_data,c);
+	vtxbyt++;
+	return 0;
 }
 
 /********************************************************
 **
-** vinit
-**
-** Initialize the VDIP connection.
+** vinblk
 **
-** This routine tests for the presence of the device, does
-** a synchronization to a known condition, ensures that
-** the device is in ASCII I/O mode and (optionally) issues 
-** any setup commands to initialize the desired settings.
+** Read n bytes from the VDIP into buff with the inblk()
+** kernel in PIO, or from the receive ring (see vintr()).
+** Gives up if the VDIP stalls for MAXWAIT seconds.
 **
 ** Returns:
-**		0: Normal
-**		-1: Error
+**		0 on Success
+**		-1 on timeout
 **
 ********************************************************/
-vinit()
+vinblk(buff, n)
+char *buff;
+int n;
 {
-	int rc;
-
-#ifdef CPM3
-	/* Set up a pointer to the one-second tick counter
-	** maintained by CP/M 3 in the System Control Block.
-	** we'll use this to test for timeouts when reading
-	** data.
-	*/
-	scbs.offset = SOSCB;	/* offset for SCB address (undocumented) */
-	scbs.set	= 0;		/* do a "get" not a "set" */
-	
-    /* Find SCB address; add offset to seconds location */
-    secp = (char *)bdoshl(GETSCB, &scbs) + SOSEC;
+#ifdef VINTR
+	int c;
+#else
+#ifdef VTRACE
+	int c;
+#endif
 #endif
 
-	rc = 0;
-	
-	/*first try to talk to the device */
-	if (vsync() == -1)
-		rc = -1;
-	else {
-		/* initialization commands */
-		
-		/* ASCII mode (more friendly) */
-		rc = vipa();
-		/* Close any open file */
-		if (rc == 0)
-			rc = vclf();
+#ifdef VTRACE
+	/* take the first byte of a reply here, to time it */
+	if (vtstat && (n > 0)) {
+		if ((c = in_vwait(MAXWAIT)) == -1)
+			return -1;
+		*buff++ = c;
+		--n;
 	}
-
-	return rc;
+#endif
+#ifdef VINTR
+	if (viring) {
+		for (; n > 0; --n) {
+			if ((c = in_vwait(MAXWAIT)) == -1)
+				return -1;
+			*buff++ = c;
+		}
+		return 0;
+	}
+#endif
+	vrxbyt += n;
+	return inblk(p_data, buff, n);
 }
 
 /********************************************************
 **
-** vsync
+** voutblk
 **
-** Flush the input buffer and attempt to handshake with
-** the VDIP1 device.  This should put things in a known
-** state.
+** Send n bytes from buff to the VDIP with the outblk()
+** kernel in PIO, or through the transmit ring.  Gives up
+** if the VDIP stalls for MAXWAIT seconds.
 **
 ** Returns:
-**		0 	successful synchronization
-**		-1	can't sync with device
+**		0 on Success
+**		-1 on timeout
 **
 ********************************************************/
-vsync()
+voutblk(buff, n)
+char *buff;
+int n;
 {
-	int i, rc;
-	
-	rc = -1;
-	
-	/* try up to 3 times to sync */
-	for (i=0; i<3; i++) {
-		/* first purge any waiting data */
-		vpurge();
-
-		/* now attempt two-way communication */
-		if (vhandshake()==0) {
-			/* we're talking! */
-			rc = 0;
-			break;
-		}
+#ifdef VINTR
+	if (viring) {
+		for (; n > 0; --n)
+			if (out_vwait(*buff++, MAXWAIT) == -1)
+				return -1;
+		return 0;
 	}
-	
-	return rc;
+#endif
+	vtxbyt += n;
+	return outblk(p_data, buff, n);
 }
 
 /********************************************************
 **
-** vdirf
-**
-** This is an interface to the Vinculum "DIR" command
-** (Directory) for a specified file.
+** vintr
 **
-** Issue a "DIR" command for the specified file name. The
-** USB drive will be searched for a matching file name and
-** will return the file size, which is returned as a long
-** in 'len'.
+** Switch the VDIP I/O to the interrupt-driven rings in
+** VINT, with the USB board interrupting on the given
+** level (RST 3 to 7, as jumpered on the board).  Needs
+** VINTR; only available on CP/M 2.2 (see above).  vpoll()
+** must be called before the program exits, and since a ^C
+** warm boot doesn't, no console I/O should be done between
+** the two: the BDOS only acts on ^C inside console calls.
 **
 ** Returns:
-**		0: Normal
-**		-1: Error (most likely means file not found)
+**		0	Success
+**		-1	not supported
 **
 ********************************************************/
-vdirf(s, len)
-char *s;
-long *len;
+vintr(level)
+int level;
 {
-	int rc;
-	char *c;
-	static union u_fil flen;
-
-	rc = 0;
-	
-	str_send("dir ");
-	str_send(s);
-	str_send("\r");
-	
-	/* first line is always blank, just read it */
-	str_rdw(linebuff, '\r');
-	
-	/* the result will either be the file name or
-	** "Command Failed". if the latter then return error.
-	*/
-	str_rdw(linebuff, '\r');
+#ifdef VINTR
+#ifdef CPM2
+	if ((level < 3) || (level > 7))
+		return -1;
+	vion(8*level, p_data);
+	viring = TRUE;
+	return 0;
+#endif
+#endif
+	return -1;
+}
 
-	if (strcmp(linebuff, CFERROR) == 0) {
-		/* flag an error! */
-		rc = -1;
+/********************************************************
+**
+** vpoll
+**
+** Go back to polled VDIP I/O, removing the interrupt
+** routine installed by vintr().
+**
+********************************************************/
+vpoll()
+{
+#ifdef VINTR
+	if (viring) {
+		vioff();
+		viring = FALSE;
 	}
-	else {
-		/* skip over file name (to first blank) */
-		for (c=linebuff; ((*c!=' ') && (*c!=0)); c++)
-			;
-		/* read file length as 4 hex values */
-		gethexvals(c, 4, &flen.b[0]);
+#endif
+}
 
-		/* return file size */
-		*len = flen.l;
-		
-		/* success - gobble up the prompt */
-		str_rdw(linebuff, '\r');
+/********************************************************
+**
+** vticks
+**
+** Return the time in milliseconds since the first call,
+** from the one-second SCB clock on CP/M 3 (so in steps of
+** 1000) or the 2 ms tick counter otherwise.  The clock is
+** followed across wrap-around as long as vticks() is
+** called at least every 59 seconds.  On CP/M 3 vinit()
+** must have been called first.
+**
+********************************************************/
+long vticks()
+{
+	static long ms;
+	static int primed;
+#ifdef CPM3
+	static int last;
+	int now, d;
+	
+	/* the SCB seconds count is BCD */
+	now = ((*secp >> 4) & 0x0F) * 10 + (*secp & 0x0F);
+	if (!primed) {
+		last = now;
+		primed = TRUE;
 	}
+	d = now - last;
+	if (d < 0)
+		d += 60;
+	last = now;
+	ms += d * 1000L;
+#else
+	static unsigned last;
+	unsigned now, d;
 	
-	return rc;
+	now = *Ticptr;
+	if (!primed) {
+		last = now;
+		primed = TRUE;
+	}
+	/* unsigned difference is right across wrap-around */
+	d = now - last;
+	last = now;
+	ms += d;
+	ms += d;
+#endif
+	return ms;
 }
 
 /********************************************************
 **
-** vdird
-**
-** This is an interface to the Vinculum "DIRT" command
-** (Directory) for a specified file.
-**
-** Issue a "DIRT" command for the specified file name. The
-** USB drive will be searched for a matching file name and
-** will return the last modified date and time in the
-** specified locations, which are passed by reference.
+** vstclr
 **
-** Returns:
-**		0: Normal
-**		-1: Error (most likely means file not found)
+** Reset the transfer counters (vrxspn, vtxspn, vrxbyt,
+** vtxbyt and vncmd) to zero.
+**
+********************************************************/
+vstclr()
+{
+	vrxspn = vtxspn = 0L;
+	vrxbyt = vtxbyt = 0L;
+	vncmd = 0L;
+}
+
+/********************************************************
+**
+** vtron
+**
+** Start tracing monitor commands (see VTRACE).
+**
+** Returns:
+**		0	Success
+**		-1	trace not built in
+**
+********************************************************/
+vtron()
+{
+#ifdef VTRACE
+	vthead = vtcnt = 0;
+	vtopen = FALSE;
+	vtstat = 0;
+	vton = TRUE;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/********************************************************
+**
+** vtrdump
+**
+** Print the command trace, oldest first, and the total
+** and longest time spent sending commands, waiting for the
+** monitor's first reply byte, and taking the reply up to
+** the prompt.  Phases that weren't seen show as "-".
+**
+********************************************************/
+vtrdump()
+{
+#ifdef VTRACE
+	int i, k, m, n, t;
+	static long tot[3];
+	static unsigned big[3], ph[3];
+	static int cnt[3];
+	
+	if (!vton)
+		return;
+	
+	for (t=0; t<3; t++) {
+		tot[t] = 0L;
+		big[t] = cnt[t] = 0;
+	}
+	n = (vtcnt < VTRN) ? vtcnt : VTRN;
+	printf("Cmd   send  first  reply (ms)\n");
+	for (i = vthead - n; i < vthead; i++) {
+		k = (i < 0) ? i + VTRN : i;
+		printf("%-4s", &vtname[k*4]);
+		
+		/* a phase is known if the stamps at both ends are */
+		ph[0] = vtsent[k] - vtt0[k];
+		ph[1] = vtfrst[k] - vtsent[k];
+		ph[2] = vtdone[k] - vtfrst[k];
+		for (t=0; t<3; t++) {
+			/* vtseen bits for the stamps ending phase t */
+			m = (t == 0) ? 1 : (3 << (t-1));
+			if ((vtseen[k] & m) != m)
+				printf("      -");
+			else {
+				printf(" %6u", ph[t]);
+				tot[t] += ph[t];
+				if (ph[t] > big[t])
+					big[t] = ph[t];
+				cnt[t]++;
+			}
+		}
+		putchar('\n');
+	}
+	printf("%d commands\n", vtcnt);
+	printf("send  total %ld max %u ms over %d\n", tot[0], big[0], cnt[0]);
+	printf("first total %ld max %u ms over %d\n", tot[1], big[1], cnt[1]);
+	printf("reply total %ld max %u ms over %d\n", tot[2], big[2], cnt[2]);
+#endif
+}
+
+#ifdef VTRACE
+/* vtmark - trace the latest command reaching state st:
+** 1 started (named by s), 2 sent, 3 first byte in, 0 done
+*/
+vtmark(st, s)
+int st;
+char *s;
+{
+	int i;
+	unsigned now;
+	static long ms;
+	
+	if ((st != 1) && !vtopen)
+		/* not part of a traced command */
+		return;
+	
+	ms = vticks();
+	now = ms;
+	if (st == 1) {
+		vtcur = vthead;
+		if (++vthead == VTRN)
+			vthead = 0;
+		vtcnt++;
+		for (i=0; (i < 3) && (s[i] > ' '); i++)
+			vtname[vtcur*4 + i] = s[i];
+		vtname[vtcur*4 + i] = NUL;
+		vtt0[vtcur] = now;
+		vtseen[vtcur] = 0;
+		vtopen = TRUE;
+	}
+	else if (st == 2) {
+		vtsent[vtcur] = now;
+		vtseen[vtcur] |= 1;
+	}
+	else if (st == 3) {
+		vtfrst[vtcur] = now;
+		vtseen[vtcur] |= 2;
+	}
+	else {
+		vtdone[vtcur] = now;
+		vtseen[vtcur] |= 4;
+		vtopen = FALSE;
+	}
+	vtstat = ((st == 1) || (st == 2)) ? st : 0;
+}
+
+/* vtgetc - vgetc() while a traced command awaits its reply */
+vtgetc()
+{
+	int c, st;
+	
+	/* the first read ends the sending */
+	if (vtstat == 1)
+		vtmark(2, linebuff);
+	
+	st = vtstat;
+	vtstat = 0;
+	c = vgetc();
+	if (c == -1)
+		vtstat = st;
+	else
+		vtmark(3, linebuff);
+	return c;
+}
+#endif
+
+/********************************************************
+**
+** vfind_disk
+**
+** Determine if there is a flash drive available on the
+** USB port. 
+**
+**
+********************************************************/
+vfind_disk()
+{
+	/* If there is a drive available then a \r will cause 
+	** the prompt to come back, so simply send \r and 
+	** then test for a command prompt...
+	*/
+	vowed();
+	str_send("\r");
+	
+	return vprompt();
+}
+
+/********************************************************
+**
+** vpurge
+**
+** Read all the pending data from the VDIP device and 
+** throw it away.  The FIFO is taken to be empty once
+** nothing has arrived for DRAINMS milliseconds.
+**
+********************************************************/
+vpurge()
+{
+	int c;
+	
+	do {
+		c = in_vms(DRAINMS);
+	} while (c != -1);
+}
+
+/********************************************************
+**
+** vhandshake
+**
+** This routine checks to see if two-way communication with 
+** the VDIP Command Monitor is working. It sends an ASCII 'E'
+** and then an 'e' and waits up to ms milliseconds for each
+** byte of the echoes.  Using two different characters makes
+** sure a stale 'E' left in the FIFO can't pass for a reply.
+**
+** Returns:
+**		0	Success
+**		-1	Error, timed out or no response
+**
+********************************************************/
+vhandshake(ms)
+unsigned ms;
+{
+	int rc;
+	
+	if (vecho('E', ms) == -1)
+		rc = -1;
+	else if (vecho('e', ms) == -1)
+		rc = -1;
+	else
+		/* success! */
+		rc = 0;
+
+	return rc;
+}
+
+/********************************************************
+**
+** vecho
+**
+** Send the echo command c ('E' or 'e') and check that
+** the monitor answers with c and a carriage return, each
+** within ms milliseconds.
+**
+** Returns:
+**		0	Success
+**		-1	Error, timed out or wrong response
+**
+********************************************************/
+vecho(c, ms)
+char c;
+unsigned ms;
+{
+	static char cmd[3];
+	
+	cmd[0] = c;
+	cmd[1] = '\r';
+	cmd[2] = NUL;
+	
+	if (str_send(cmd) == -1)
+		/* time out on send! */
+		return -1;
+	else if (in_vms(ms) != c)
+		/* no or wrong response! */
+		return -1;
+	else if (in_vms(ms) != '\r')
+		return -1;
+	else
+		return 0;
+}
+
+/********************************************************
+**
+** vinit
+**
+** Initialize the VDIP connection.
+**
+** This routine tests for the presence of the device, does
+** a synchronization to a known condition, ensures that
+** the device is in ASCII I/O mode (or compact mode if
+** vcompact is TRUE) and (optionally) issues any setup
+** commands to initialize the desired settings.
+**
+** Returns:
+**		0: Normal
+**		-1: Error
+**
+********************************************************/
+vinit()
+{
+	int rc;
+
+#ifdef CPM3
+	/* Set up a pointer to the one-second tick counter
+	** maintained by CP/M 3 in the System Control Block.
+	** we'll use this to test for timeouts when reading
+	** data.
+	*/
+	scbs.offset = SOSCB;	/* offset for SCB address (undocumented) */
+	scbs.set	= 0;		/* do a "get" not a "set" */
+	
+    /* Find SCB address; add offset to seconds location */
+    secp = (char *)bdoshl(GETSCB, &scbs) + SOSEC;
+
+	/* block transfers give up after MAXWAIT seconds */
+	blkarm(secp, MAXWAIT);
+#else
+	/* block transfers give up after MAXWAIT seconds of
+	** 500 ticks, watching the low byte of the tick count
+	*/
+	blkarm(Ticptr, MAXWAIT*500);
+#endif
+	/* and count the polls spent waiting */
+	blkctr(&vrxspn, &vtxspn);
+
+	rc = 0;
+	vpend = FALSE;
+	vperr = FALSE;
+	vwfill = 0;
+	vrlen = vrnext = 0;
+	vdqn = 0;
+	vdname[0] = NUL;
+	
+	/* a reset VDIP is back in the root, which a caller
+	** must find out again (see vcwdld())
+	*/
+	vcwdok = FALSE;
+	
+	/* a previous program may have left anything open */
+	vsopen = VS_UNK;
+	vfposok = FALSE;
+	vsmode = -1;
+	
+	/*first try to talk to the device */
+	if (vsync() == -1)
+		rc = -1;
+	else {
+		/* initialization commands */
+		
+		/* command set and number mode: ECS and ASCII
+		** (more friendly) unless compact mode was asked for
+		*/
+		rc = vmode(vcompact);
+		
+		/* any open file is closed by the first command
+		** that needs it closed (see vsnone())
+		*/
+	}
+
+	return rc;
+}
+
+/********************************************************
+**
+** vsync
+**
+** Flush the input buffer and attempt to handshake with
+** the VDIP1 device.  This should put things in a known
+** state.  A healthy device answers the first handshake in
+** a few milliseconds; the timeout is doubled on each retry
+** (up to SYNCMAX) so a slow or busy device still gets time.
+**
+** Returns:
+**		0 	successful synchronization
+**		-1	can't sync with device
+**
+********************************************************/
+vsync()
+{
+	unsigned ms;
+	
+	for (ms=SYNCMS; ms <= SYNCMAX; ms <<= 1) {
+		/* first purge any waiting data */
+		vpurge();
+
+		/* now attempt two-way communication */
+		if (vhandshake(ms) == 0)
+			/* we're talking! */
+			return 0;
+	}
+	
+	return -1;
+}
+
+/********************************************************
+**
+** vdirf
+**
+** This is an interface to the Vinculum "DIR" command
+** (Directory) for a specified file.
+**
+** Issue a "DIR" command for the specified file name. The
+** USB drive will be searched for a matching file name and
+** will return the file size, which is returned as a long
+** in 'len'.
+**
+** Returns:
+**		0: Normal
+**		-1: Error (most likely means file not found)
+**
+********************************************************/
+vdirf(s, len)
+char *s;
+long *len;
+{
+	vdirfs(s);
+	return vdirfr(s, len);
+}
+
+/* vdirfs - send the "DIR" command for file s */
+vdirfs(s)
+char *s;
+{
+	vcmd("dir ", S_DIR);
+	str_send(s);
+	return str_send("\r");
+}
+
+/* vdirfr - read the reply to the "DIR" command sent for
+** file s by vdirfs() and return the size in len
+*/
+vdirfr(s, len)
+char *s;
+long *len;
+{
+	int rc;
+	char *c;
+	static union u_fil flen;
+
+	rc = 0;
+	
+	/* first line is always blank, just read it */
+	str_rdw(linebuff, '\r');
+	
+	/* the result will either be the file name or
+	** "Command Failed". if the latter then return error.
+	*/
+	if (vcompact) {
+		/* file name followed by 4 binary bytes */
+		rc = vrdbin(&flen.b[0], 4);
+	}
+	else {
+		str_rdw(linebuff, '\r');
+
+		if (viscf(linebuff)) {
+			/* flag an error! */
+			rc = -1;
+		}
+		else {
+			/* skip over file name (to first blank) */
+			for (c=linebuff; ((*c!=' ') && (*c!=0)); c++)
+				;
+			/* read file length as 4 hex values */
+			gethexvals(c, 4, &flen.b[0]);
+		}
+	}
+
+	/* remember the size for vropen() and vwopen(), -1 if
+	** there is no such file
+	*/
+	vcpnam(vdname, s);
+	vdsize = -1L;
+	
+	if (rc == 0) {
+		/* return file size */
+		*len = flen.l;
+		vdsize = flen.l;
+		
+		/* success - gobble up the prompt */
+		str_rdw(linebuff, '\r');
+	}
+	
+	return rc;
+}
+
+/********************************************************
+**
+** vdnone
+**
+** Note that the file s is not on the flash drive, e.g.
+** because it isn't in a directory listing just read, as if
+** vdirf() had been asked about it.  vwopen() then knows
+** that the new file's pointer starts at 0, and a seek
+** there isn't sent.
+**
+********************************************************/
+vdnone(s)
+char *s;
+{
+	vcpnam(vdname, s);
+	vdsize = -1L;
+}
+
+/* vcpnam - copy file name s (up to 12 characters) to d */
+vcpnam(d, s)
+char *d, *s;
+{
+	int i;
+	
+	for (i=0; (i < 12) && (s[i] != NUL); i++)
+		d[i] = s[i];
+	d[i] = NUL;
+}
+
+/********************************************************
+**
+** vdird
+**
+** This is an interface to the Vinculum "DIRT" command
+** (Directory) for a specified file.
+**
+** Issue a "DIRT" command for the specified file name. The
+** USB drive will be searched for a matching file name and
+** will return the last modified date and time in the
+** specified locations, which are passed by reference.
+**
+** Returns:
+**		0: Normal
+**		-1: Error (most likely means file not found)
 **
 ********************************************************/
 vdird(s, udate, utime)
 char *s;
-unsigned *udate, *utime;
+unsigned *udate, *utime;
+{
+	vdirds(s);
+	return vdirdr(udate, utime);
+}
+
+/* vdirds - send the "DIRT" command for file s */
+vdirds(s)
+char *s;
+{
+	vcmd("dirt ", S_DIRT);
+	str_send(s);
+	return str_send("\r");
+}
+
+/* vdirdr - read the reply to the "DIRT" command sent by
+** vdirds() and return the date and time
+*/
+vdirdr(udate, utime)
+unsigned *udate, *utime;
+{
+	int i, rc;
+	char *c;
+	static union u_fil fdate;
+	static char dates[10];
+	
+	rc = 0;
+	
+	/* first line is always blank, just read it */
+	str_rdw(linebuff, '\r');
+	
+	/* result will either be the file name followed
+	** by 10 bytes, or "Command Failed".
+	*/
+	if (vcompact) {
+		/* file name followed by 10 binary bytes */
+		rc = vrdbin(dates, 10);
+	}
+	else {
+		str_rdw(linebuff, '\r');
+
+		if (viscf(linebuff)) {
+			/* flag an error! */
+			rc = -1;
+		}
+		else {
+			/* skip over the file name (to first blank) */
+			for (c=linebuff; ((*c!=' ') && (*c!=0)); c++)
+				;
+			/* read all 3 date fields */
+			gethexvals(c, 10, dates);
+		}
+	}
+
+	if (rc == 0) {
+		/* last 4 bytes are the modification date */
+		for (i=0; i<4; i++)
+			fdate.b[i] = dates[i+6];
+
+		/* return date and time */
+		*utime = fdate.i[0];
+		*udate = fdate.i[1];
+		
+		/* success - gobble up the prompt */
+		str_rdw(linebuff, '\r');
+	}
+	return rc;
+}
+
+/********************************************************
+**
+** vdirq
+**
+** Queue the "DIR" and "DIRT" commands for file s without
+** waiting for the replies, which are then collected, in
+** the same order, by vdira().  Listing a directory one
+** file at a time leaves the monitor idle while each reply
+** is parsed; with the next file's commands already sitting
+** in the VDIP's receive FIFO it goes straight on to them.
+** Typical use, one file ahead:
+**
+**	vdirq(name[0]);
+**	for (i=0; i<n; i++) {
+**		if (i+1 < n)
+**			vdirq(name[i+1]);
+**		vdira(name[i], &size, &date, &time);
+**	}
+**
+** Keep to one file ahead.  The queued commands and the
+** replies not yet read then fit in the VDIP's FIFOs, so
+** the host can't be left waiting to send while the monitor
+** waits for its output to be read.  Nothing is queued
+** while tracing (see vtron()), since the trace times one
+** command at a time; vdira() then sends the commands
+** itself.
+**
+********************************************************/
+vdirq(s)
+char *s;
+{
+#ifdef VTRACE
+	if (vton)
+		return;
+#endif
+	vdirfs(s);
+	vdirds(s);
+	vdqn++;
+}
+
+/********************************************************
+**
+** vdira
+**
+** Collect the replies to the commands queued for file s
+** by vdirq() (or send them first if none are queued) and
+** return its size, date and time as vdirf() and vdird()
+** do.
+**
+** Returns:
+**		0: Normal
+**		-1: Error (most likely means file not found)
+**
+********************************************************/
+vdira(s, len, udate, utime)
+char *s;
+long *len;
+unsigned *udate, *utime;
+{
+	int rc;
+
+	if (vdqn > 0)
+		vdqn--;
+	else {
+		vdirfs(s);
+		vdirds(s);
+	}
+
+	/* both replies must be read to stay in step */
+	rc = vdirfr(s, len);
+	if (vdirdr(udate, utime) == -1)
+		rc = -1;
+	return rc;
+}
+
+
+/********************************************************
+**
+** vprompt
+**
+** check for "D:\>" prompt. 
+**
+** Returns:
+**		0 Normal
+**		-1 on error (no prompt or timeout)
+**
+********************************************************/
+vprompt()
+{
+#ifdef DEBUG
+	printf("->vprompt\n");
+#endif
+
+	/* check for normal prompt return (return if timeout),
+	** after an error nothing is known about the open file
+	*/
+	if ((str_rdw(linebuff, '\r') == -1) || !visprompt(linebuff)) {
+		vsopen = VS_UNK;
+		vfposok = FALSE;
+		return -1;
+	}
+	return 0;
+}
+
+/********************************************************
+**
+** vropen
+**
+** This is an interface to the Vinculum "OPR" command
+** (Open File For Read).
+**
+** Open a file for reading.
+**
+** Returns:
+**		0 normal
+**		-1 on error
+**
+********************************************************/
+vropen(s)
+char *s;
+{
+	int rc;
+	
+	/* the file is already open for read: just go back to
+	** the start of it
+	*/
+	if ((vsopen == VS_READ) && (strcmp(s, vsname) == 0)) {
+		vcinval();
+		rc = vlseek(0L);
+		vrleft = vrsize;
+		return rc;
+	}
+	
+	/* as a safety measure, close any open file */
+	vsnone();
+	
+	vcmd("opr ", S_OPR);
+	str_send(s);
+	str_send("\r");
+	
+	/* reading starts at 0; the size is known if vdirf()
+	** was just asked about this file
+	*/
+	vfpos = 0L;
+	vrlen = vrnext = 0;
+	vcinval();
+	if (strcmp(s, vdname) == 0)
+		vrsize = vdsize;
+	else
+		vrsize = -1L;
+	vrleft = vrsize;
+	
+	if ((rc = vprompt()) == 0)
+		vsset(VS_READ, s);
+	return rc;
+}
+
+/* vsset - note that file s is now open in state st,
+** with the pointer at vfpos unless an earlier call said
+** otherwise
+*/
+vsset(st, s)
+int st;
+char *s;
+{
+	vsopen = st;
+	vcpnam(vsname, s);
+	if (st == VS_READ)
+		vfposok = TRUE;
+}
+
+/********************************************************
+**
+** vwopen
+**
+** This is an interface to the Vinculum "OPW" command
+** (Open File For Write).
+**
+** Open a file for writing, including a user-specified
+** time/date stamp.
+**
+** Returns:
+**		0 normal
+**		-1 on error
+**
+********************************************************/
+vwopen(s)
+char *s;
+{
+	int rc;
+	
+	/* as a safety measure, close any open file */
+	vsnone();
+	
+	vcmd("opw ", S_OPW);
+	str_send(s);
+	vdate();
+	str_send("\r");
+	
+	/* OPW leaves the pointer at the end of an existing
+	** file.  If vdirf() (or vdnone()) was just asked about
+	** this file that is known, otherwise until vseek()
+	** output is coalesced as if it were on a sector
+	** boundary.
+	*/
+	vfpos = 0L;
+	vfposok = FALSE;
+	if (strcmp(s, vdname) == 0) {
+		if (vdsize > 0L)
+			vfpos = vdsize;
+		vfposok = TRUE;
+		
+		/* the file is about to change */
+		vdname[0] = NUL;
+	}
+	vwfill = 0;
+	vrsize = vrleft = -1L;
+	vcinval();
+	
+	/* allow a little extra time if new file */
+	if ((rc = vprompt()) == 0)
+		vsset(VS_WRITE, s);
+	return rc;
+}
+
+/********************************************************
+**
+** vseek
+**
+** This is an interface to the Vinculum "SEK" command
+** (Seek).
+**
+** This routine seeks to an absolute offset position
+** in an open file. 
+**
+********************************************************/
+vseek(p)
+int p;
+{
+	static long fpos;
+	
+	fpos = p;
+	return vlseek(fpos);
+}
+
+/********************************************************
+**
+** vlseek
+**
+** Same as vseek() for a long offset.  Pending vwrite()
+** output is written first and read-ahead is dropped.
+**
+** Returns:
+**		0 normal
+**		-1 on error
+**
+********************************************************/
+vlseek(pos)
+long pos;
+{
+	if (vwflush() == -1)
+		return -1;
+	vrlen = vrnext = 0;
+	
+	/* nothing to do if the pointer is already there */
+	if (vfposok && (pos == vfpos) && (vsopen > VS_NONE))
+		return 0;
+	
+	vfpos = pos;
+	if (vrsize >= 0L)
+		vrleft = vrsize - pos;
+	
+	vcmd("sek", S_SEK);
+	vnum(pos);
+	str_send("\r");
+	if (vprompt() == -1)
+		return -1;
+	vfposok = TRUE;
+	return 0;
+}
+
+/********************************************************
+**
+** vclose
+**
+** This is an interface to the Vinculum "CLF" command
+** (Close File).
+**
+** This closes the specified file on the USB device.
+** This should be called after a vropen() and vread()
+** sequence, or a vwopen() and vwrite() sequence of calls.
+**
+********************************************************/
+vclose(s)
+char *s;
+{
+	vwflush();
+	if (vsopen != VS_READ)
+		vdname[0] = NUL;
+	vcmd("clf ", S_CLF);
+	str_send(s);
+	str_send("\r");
+	if (vprompt() == -1)
+		return -1;
+	vsopen = VS_NONE;
+	return 0;
+}
+
+/********************************************************
+**
+** vdel
+**
+** This is an interface to the Vinculum "DLF" command
+** (Delete File).
+**
+** Returns:
+**		0 normal
+**		-1 on error (e.g. no such file)
+**
+********************************************************/
+vdel(s)
+char *s;
+{
+	vsnone();
+	vdname[0] = NUL;
+	
+	vcmd("dlf ", S_DLF);
+	str_send(s);
+	str_send("\r");
+	return vprompt();
+}
+
+/********************************************************
+**
+** vmkd
+**
+** This is an interface to the Vinculum "MKD" command
+** (Make Directory).  The directory is made in the current
+** one.
+**
+** Returns:
+**		0 normal
+**		-1 on error (e.g. it already exists)
+**
+********************************************************/
+vmkd(s)
+char *s;
+{
+	vcmd("mkd ", S_MKD);
+	str_send(s);
+	str_send("\r");
+	return vprompt();
+}
+
+/********************************************************
+**
+** vqclose
+**
+** Same as vclose() but doesn't wait for the monitor to
+** finish: the prompt is collected by the next command or
+** by vsettle().  The caller can meanwhile do local work,
+** e.g. closing its own copy of the file.
+**
+********************************************************/
+vqclose(s)
+char *s;
+{
+	vwflush();
+	if (vsopen != VS_READ)
+		vdname[0] = NUL;
+	vcmd("clf ", S_CLF);
+	str_send(s);
+	str_send("\r");
+	vpend = TRUE;
+	
+	/* an error in the owed prompt makes this unknown */
+	vsopen = VS_NONE;
+	return 0;
+}
+
+/********************************************************
+**
+** vsettle
+**
+** Wait for any prompt still owed by the monitor and report
+** whether it, or one collected along the way by another
+** command since the last call, was an error.
+**
+** Returns:
+**		0 normal
+**		-1 on error
+**
+********************************************************/
+vsettle()
+{
+	vowed();
+	if (vperr) {
+		vperr = FALSE;
+		return -1;
+	}
+	return 0;
+}
+
+/* vowed - collect an owed prompt, noting an error in vperr */
+vowed()
+{
+	if (vpend) {
+		vpend = FALSE;
+		if (vprompt() == -1)
+			vperr = TRUE;	/* and the state is unknown */
+	}
+}
+
+/********************************************************
+**
+** vclf
+**
+** This is an interface to the Vinculum "CLF" command
+** (Close File).
+**
+** This closes the currently open file on the USB device.
+** This should be called after a vropen() and vread()
+** sequence, or a vwopen() and vwrite() sequence of calls.
+**
+********************************************************/
+vclf()
+{
+	vwflush();
+	if (vsopen != VS_READ)
+		vdname[0] = NUL;
+	vcmd("clf", S_CLF);
+	str_send("\r");
+	if (vprompt() == -1)
+		return -1;
+	vsopen = VS_NONE;
+	return 0;
+}
+
+/********************************************************
+**
+** vsnone
+**
+** Make sure that no file is open, before a command that
+** needs none to be.  A CLF is only sent if a file is, or
+** might be, open; with nothing open the monitor would
+** just fail it.  The file is taken as closed either way.
+**
+********************************************************/
+vsnone()
+{
+	if (vsopen != VS_NONE)
+		vclf();
+	vsopen = VS_NONE;
+}
+
+/********************************************************
+**
+** vipa
+**
+** This is an interface to the Vinculum "IPA" command
+** (Input In ASCII).
+**
+** This routine ensures that the monitor’s mode for 
+** inputting and displaying values is printable ASCII
+** characters. 
+**
+********************************************************/
+vipa()
+{
+	vcmd("ipa", S_IPA);
+	str_send("\r");
+	return vprompt();
+}
+
+/********************************************************
+**
+** viph
+**
+** This is an interface to the Vinculum "IPH" command
+** (Input In Hex).
+**
+** Numeric values are sent and returned as binary bytes;
+** used with the Short Command Set in compact mode.
+**
+********************************************************/
+viph()
+{
+	vcmd("iph", S_IPH);
+	str_send("\r");
+	return vprompt();
+}
+
+/********************************************************
+**
+** vmode
+**
+** Select the protocol mode.  If compact is TRUE the
+** monitor is switched to the Short Command Set ("SCS")
+** and binary numbers ("IPH"), otherwise to the Extended
+** Command Set ("ECS") and ASCII numbers ("IPA").  The
+** SCS/ECS command is sent in its short form, which the
+** monitor accepts in either mode, so this works whatever
+** mode a previous program left the device in.
+**
+** Returns:
+**		0 normal
+**		-1 on error
+**
+********************************************************/
+vmode(compact)
+int compact;
+{
+	int rc;
+	static char sc[3];
+	
+	/* already in that mode */
+	if (compact == vsmode)
+		return 0;
+	
+	sc[0] = compact ? S_SCS : S_ECS;
+	sc[1] = '\r';
+	sc[2] = NUL;
+	str_send(sc);
+	vcompact = compact;
+	
+	rc = vprompt();
+	if (rc == 0)
+		rc = compact ? viph() : vipa();
+	if (rc == 0)
+		vsmode = compact;
+	
+	return rc;
+}
+
+/********************************************************
+**
+** vcmd
+**
+** Send the monitor command s, e.g. "rdf" or "dir ".  In
+** compact mode the Short Command Set opcode 'code' is sent
+** instead, followed by a blank if s ends in one (meaning
+** that a parameter follows).
+**
+** Returns:
+**		0	Success
+**		-1	I/O error
+**
+********************************************************/
+vcmd(s, code)
+char *s;
+int code;
 {
-	int i, rc;
+	static char sc[3];
+	
+	/* the monitor must be done with the previous command */
+	vowed();
+	vncmd++;
+	
+#ifdef VTRACE
+	if (vton)
+		vtmark(1, s);
+#endif
+	if (!vcompact)
+		return str_send(s);
+	
+	sc[0] = code;
+	sc[1] = (s[strlen(s)-1] == ' ') ? ' ' : NUL;
+	sc[2] = NUL;
+	return str_send(sc);
+}
+
+/********************************************************
+**
+** visprompt
+**
+** Returns TRUE if the line s is the monitor prompt for
+** the current protocol mode.
+**
+********************************************************/
+visprompt(s)
+char *s;
+{
+	if (strcmp(s, vcompact ? SPROMPT : PROMPT) != 0)
+		return FALSE;
+#ifdef VTRACE
+	vtmark(0, s);
+#endif
+	return TRUE;
+}
+
+/********************************************************
+**
+** viscf
+**
+** Returns TRUE if the line s is the monitor's "Command
+** Failed" message for the current protocol mode.
+**
+********************************************************/
+viscf(s)
+char *s;
+{
+	if (strcmp(s, vcompact ? SCFERROR : CFERROR) != 0)
+		return FALSE;
+#ifdef VTRACE
+	vtmark(0, s);
+#endif
+	return TRUE;
+}
+
+/********************************************************
+**
+** vlist
+**
+** Issue a "DIR" command for the current directory and
+** discard the blank line that starts the listing.  The
+** caller then reads one entry per line with str_rdw()
+** until visprompt() is TRUE.
+**
+********************************************************/
+vlist()
+{
+	vcmd("dir", S_DIR);
+	str_send("\r");
+	
+	/* the first line is always blank - toss it! */
+	return str_rdw(linebuff, '\r');
+}
+
+/********************************************************
+**
+** vidsum
+**
+** This is an interface to the Vinculum "IDDE" command
+** (Identify Disk Drive Extended).
+**
+** Returns a 16-bit checksum of the reply, which covers the
+** drive's vendor, product, volume label and serial number.
+** It is used as a cheap check that the same volume is still
+** inserted.  IDDE is used rather than IDD since it does not
+** scan the FAT for the free space.  The reply is always
+** taken in ASCII mode so that it can be read line by line.
+**
+********************************************************/
+vidsum()
+{
+	unsigned sum;
+	int done;
 	char *c;
-	static union u_fil fdate;
-	static char dates[10];
 	
-	rc = 0;
+	if (vcompact)
+		vipa();
 	
-	str_send("dirt ");
-	str_send(s);
+	vcmd("idde", S_IDDE);
 	str_send("\r");
 	
-	/* first line is always blank, just read it */
-	str_rdw(linebuff, '\r');
+	sum = 0;
+	do {
+		if (str_rdw(linebuff, '\r') == -1)
+			break;
+		done = (visprompt(linebuff) || viscf(linebuff));
+		
+		/* rotate and add each character */
+		for (c=linebuff; *c!=NUL; c++)
+			sum = ((sum << 1) | (sum >> 15)) + *c;
+	} while (!done);
 	
-	/* result will either be the file name followed
-	** by 10 bytes, or "Command Failed".
-	*/
-	str_rdw(linebuff, '\r');
+	if (vcompact)
+		viph();
+	
+	return sum;
+}
 
-	if (strcmp(linebuff, CFERROR) == 0) {
-		/* flag an error! */
-		rc = -1;
+/********************************************************
+**
+** vrdbin
+**
+** Read a compact (IPH) mode directory reply: a file name
+** terminated by a blank, then n binary bytes which are
+** stored in val[], then a carriage return.  The name is
+** left in linebuff.  A line with no blank is an error
+** message (e.g. "CF").
+**
+** Returns:
+**		0 on Success
+**		-1 on Error
+**
+********************************************************/
+vrdbin(val, n)
+char val[];
+int n;
+{
+	int i, c;
+	char *s;
+	
+	/* file name up to the blank */
+	for (s=linebuff; ; *s++ = c) {
+		c = in_vwait(MAXWAIT);
+		if ((c == -1) || (c == ' ') || (c == '\r'))
+			break;
 	}
-	else {
-		/* skip over the file name (to first blank) */
-		for (c=linebuff; ((*c!=' ') && (*c!=0)); c++)
-			;
-		/* read all 3 date fields */
-		gethexvals(c, 10, dates);
+	*s = NUL;
+	if (c != ' ')
+		return -1;
+	
+	/* binary values may hold any byte, even '\r' */
+	for (i=0; i<n; i++) {
+		if ((c = in_vwait(MAXWAIT)) == -1)
+			return -1;
+		val[i] = c;
+	}
+	
+	/* and the end of the line */
+	return (in_vwait(MAXWAIT) == '\r') ? 0 : -1;
+}
 
-		/* last 4 bytes are the modification date */
+/********************************************************
+**
+** vdate
+**
+** Send the time/date parameter for OPW.  td_string holds
+** it as " $xxxxxxxx" (see settd()), which is sent as is
+** in ASCII mode or converted to 4 binary bytes in compact
+** mode.
+**
+********************************************************/
+vdate()
+{
+	int i;
+	
+	if (!vcompact)
+		str_send(td_string);
+	else if (td_string[0] != NUL) {
+		out_vwait(' ', MAXWAIT);
 		for (i=0; i<4; i++)
-			fdate.b[i] = dates[i+6];
-
-		/* return date and time */
-		*utime = fdate.i[0];
-		*udate = fdate.i[1];
-		
-		/* success - gobble up the prompt */
-		str_rdw(linebuff, '\r');
+			out_vwait(hexval(td_string+2+i+i), MAXWAIT);
 	}
-	return rc;
 }
 
+/********************************************************
+**
+** vread
+**
+** This is an interface to the Vinculum "RDF" command
+** (Read From File).
+**
+** This routine should only be called after a successful
+** call to vropen(), which opens a file on the device
+** for reading.  This routine reads n bytes from the file
+** on the USB device, storing them in the provided buffer.
+**
+** If the file size is known each RDF runs to a sector
+** boundary (or the end of the file): whole sectors go
+** straight into the buffer, and a sector only partly
+** wanted is read into vrbuf and handed out from there.
+**
+** Returns:
+**		0 on Success
+**		-1 on Error (or end of file)
+**
+********************************************************/
+vread(buff, n)
+char *buff;
+int n;
+{
+	int k;
+	static long ln;
+	
+#ifdef DEBUG
+	printf("->vread\n");
+#endif
+	while (n > 0) {
+		if (vrnext < vrlen) {
+			/* hand out bytes already read */
+			for (k=0; (k < n) && (vrnext < vrlen); k++)
+				*buff++ = vrbuf[vrnext++];
+		}
+		else if (vrleft < 0L) {
+			/* file size unknown, read just what was asked */
+			k = n;
+			if (vrdf(buff, k) == -1)
+				return -1;
+			buff += k;
+		}
+		else {
+			/* read to the next sector boundary, or through
+			** as many whole sectors as the caller wants
+			*/
+			k = VSECT - vsecoff(vfpos);
+			if ((k == VSECT) && (n >= VSECT))
+				k = n & ~(VSECT-1);
+			ln = k;
+			if (ln > vrleft)
+				k = vrleft;
+			if (k == 0)
+				/* end of file */
+				return -1;
+			
+			if (k <= n) {
+				if (vrdf(buff, k) == -1)
+					return -1;
+				buff += k;
+			}
+			else {
+				if (vrdf(vrbuf, k) == -1)
+					return -1;
+				vrlen = k;
+				vrnext = 0;
+				/* handed out on the next pass */
+				k = 0;
+			}
+		}
+		n -= k;
+	}
+	
+	return 0;
+}
 
 /********************************************************
 **
-** vprompt
+** vrdf
 **
-** check for "D:\>" prompt. 
+** Read n bytes into buff from the file open for reading,
+** with one RDF command.  Unlike vread() nothing is read
+** ahead, and the bytes must be in the file: a read past
+** its end waits for data that never comes.
 **
 ** Returns:
-**		0 Normal
-**		-1 on error (no prompt or timeout)
+**		0 normal
+**		-1 on error
 **
 ********************************************************/
-vprompt()
+vrdf(buff, n)
+char *buff;
+int n;
 {
+	static long fsize;
+	
+	/* send read from file (RDF) command */
+	fsize = n;
+	vcmd("rdf", S_RDF);
+	vnum(fsize);
+	str_send("\r");
+	
+	vfpos += n;
+	if (vrleft >= 0L)
+		vrleft -= n;
+	
+	/* immediately capture the result in the buffer */
+	if (vinblk(buff, n) == -1)
+		return -1;
 #ifdef DEBUG
-	printf("->vprompt\n");
+    printf("%d bytes read\n", n);
 #endif
 
-	/* check for normal prompt return (return if timeout) */
-	if (str_rdw(linebuff, '\r') == -1)
+	return vprompt();
+}
+
+/* vsecoff - offset of file position pos within its sector */
+vsecoff(pos)
+long pos;
+{
+	static union u_fil num;
+	
+	num.l = pos;
+	return num.i[0] & (VSECT-1);
+}
+
+/********************************************************
+**
+** vwrite
+**
+** This is an interface to the Vinculum "WRF" command
+** (Write To File).
+**
+** This routine should only be called after a successful
+** call to vwopen(), which opens a file on the device
+** for writing.  This routine writes n bytes from the
+** provided buffer to the file on the USB device.
+**
+** Bytes are only sent in WRF commands that end on a
+** sector boundary: whole sectors go straight out of the
+** caller's buffer, anything else is kept in vwbuf until
+** the sector is complete or vwflush() is called.  An
+** error may therefore show up on a later call.
+**
+** Returns:
+**		0 on Success
+**		-1 on Error
+**
+********************************************************/
+vwrite(buff, n)
+char *buff;
+int n;
+{
+	int i, k;
+	static long ln;
+	
+	while (n > 0) {
+		ln = vfpos + vwfill;
+		k = VSECT - vsecoff(ln);
+		if ((vwfill == 0) && (k == VSECT) && (n >= VSECT)) {
+			/* whole sectors straight from the caller */
+			k = n & ~(VSECT-1);
+			if (vwrf(buff, k) == -1)
+				return -1;
+			buff += k;
+		}
+		else {
+			/* fill up to the sector boundary */
+			if (k > n)
+				k = n;
+			for (i=0; i<k; i++)
+				vwbuf[vwfill++] = *buff++;
+			ln = vfpos + vwfill;
+			if ((vsecoff(ln) == 0) && (vwflush() == -1))
+				return -1;
+		}
+		n -= k;
+	}
+	
+	return 0;
+}
+
+/********************************************************
+**
+** vwflush
+**
+** Write out any vwrite() output still held back.
+**
+** Returns:
+**		0 on Success
+**		-1 on Error
+**
+********************************************************/
+vwflush()
+{
+	int n;
+	
+	if ((n = vwfill) == 0)
+		return 0;
+	vwfill = 0;
+	return vwrf(vwbuf, n);
+}
+
+/********************************************************
+**
+** vwrf
+**
+** Write n bytes from buff to the file open for writing,
+** with one WRF command.  Unlike vwrite() the bytes aren't
+** collected into sectors, so any vwrite() output must be
+** flushed first (see vwflush()).
+**
+** Returns:
+**		0 normal
+**		-1 on error
+**
+********************************************************/
+vwrf(buff, n)
+char *buff;
+int n;
+{
+	static long wsize;
+	
+	/* write to file (WRF) command */
+	vdname[0] = NUL;
+	wsize = n;
+	vcmd("wrf", S_WRF);
+	vnum(wsize);
+	str_send("\r");
+	vfpos += n;
+	
+	/* now output the n bytes to the device */
+	if (voutblk(buff, n) == -1)
+		return -1;
+
+	return vprompt();
+}
+
+/********************************************************
+**
+** vpread
+**
+** Read n bytes at offset pos of the file open for reading,
+** through the block cache.  If vropen() didn't learn the
+** file size it is asked for with vdirf() first, so that no
+** read goes past the end of the file.  Without cache memory
+** the bytes are read directly.  Afterwards the file
+** pointer is left at the end of the last block read, so
+** sequential reads should vlseek() first.
+**
+** Returns:
+**		number of bytes read, less than n at end of file
+**		-1 on error, or if the file size can't be found
+**
+********************************************************/
+vpread(pos, buff, n)
+long pos;
+char *buff;
+int n;
+{
+	int i, k, got;
+	char *p;
+	static long ln;
+	
+	/* any vread() read-ahead is about to go stale */
+	vrlen = vrnext = 0;
+	
+	if (vrsize < 0L) {
+		if (vdirf(vsname, &ln) == -1)
+			return -1;
+		vrsize = ln;
+		vrleft = vrsize - vfpos;
+	}
+	
+	if (vcdata == 0) {
+		if ((vcdata = alloc(VNBLK*VSECT)) != 0)
+			vcinval();
+	}
+	
+	if (vcdata == 0) {
+		/* read directly, up to the end of the file */
+		if (pos >= vrsize)
+			return 0;
+		ln = vrsize - pos;
+		if (ln < n)
+			n = ln;
+		if (vlseek(pos) == -1)
+			return -1;
+		if (vrdf(buff, n) == -1)
+			return -1;
+		return n;
+	}
+	
+	got = 0;
+	while ((n > 0) && (pos < vrsize)) {
+		if ((i = vcfind(pos)) == -1)
+			return -1;
+		
+		/* copy what this block has of the request */
+		k = vsecoff(pos);
+		p = vcdata + i*VSECT + k;
+		k = vclen[i] - k;
+		if (k > n)
+			k = n;
+		pos += k;
+		got += k;
+		n -= k;
+		while (k-- > 0)
+			*buff++ = *p++;
+	}
+	
+	return got;
+}
+
+/* vcfind - cache slot holding the block containing pos,
+** reading it into the least recently used slot if need be.
+** Returns -1 on error.
+*/
+vcfind(pos)
+long pos;
+{
+	int i, old, k;
+	static union u_fil num;
+	static long ln;
+	
+	/* offset of the start of the block */
+	num.l = pos;
+	num.i[0] &= ~(VSECT-1);
+	
+	vcclk++;
+	old = 0;
+	for (i=0; i<VNBLK; i++) {
+		if (vcpos[i] == num.l) {
+			vcuse[i] = vcclk;
+			return i;
+		}
+		if ((vcclk - vcuse[i]) > (vcclk - vcuse[old]))
+			old = i;
+	}
+	
+	/* read the block, short at end of file */
+	vcpos[old] = -1L;
+	k = VSECT;
+	ln = vrsize - num.l;
+	if (ln < VSECT)
+		k = ln;
+	if ((vfpos != num.l) && (vlseek(num.l) == -1))
 		return -1;
-	else if (strcmp(linebuff, PROMPT) != 0 )
+	if (vrdf(vcdata + old*VSECT, k) == -1)
 		return -1;
-	else
-		return 0;
+	
+	vcpos[old] = num.l;
+	vclen[old] = k;
+	vcuse[old] = vcclk;
+	return old;
 }
 
-/********************************************************
-**
-** vropen
-**
-** This is an interface to the Vinculum "OPR" command
-** (Open File For Read).
-**
-** Open a file for reading.
-**
-** Returns:
-**		0 normal
-**		-1 on error
-**
-********************************************************/
-vropen(s)
-char *s;
+/* vcinval - empty the vpread() block cache */
+vcinval()
 {
-	/* as a safety measure, close any open file */
-	vclf();
+	int i;
 	
-	str_send("opr ");
-	str_send(s);
-	str_send("\r");
-	return vprompt();
+	for (i=0; i<VNBLK; i++)
+		vcpos[i] = -1L;
 }
 
 /********************************************************
 **
-** vwopen
-**
-** This is an interface to the Vinculum "OPW" command
-** (Open File For Write).
+** vnum
 **
-** Open a file for writing, including a user-specified
-** time/date stamp.
+** Send a 32-bit numeric command parameter, preceded by
+** a blank, to the VDIP.  The value is sent in the monitor's
+** "$xxxxxxxx" hexadecimal form so that no long divisions
+** are needed to format it, or in compact mode as 4 binary
+** bytes.
 **
 ** Returns:
-**		0 normal
-**		-1 on error
+**		0	Success
+**		-1	I/O error
 **
 ********************************************************/
-vwopen(s)
-char *s;
+vnum(n)
+long n;
 {
-	/* as a safety measure, close any open file */
-	vclf();
+	int i;
+	static union u_fil num;
+	static char nstr[11];
 	
-	str_send("opw ");
-	str_send(s);
-	str_send(td_string);
-	str_send("\r");
+	num.l = n;
 	
-	/* allow a little extra time if new file */
-	return vprompt();
+	if (vcompact) {
+		/* binary, most significant byte first */
+		out_vwait(' ', MAXWAIT);
+		for (i=3; i>=0; i--)
+			if (out_vwait(num.b[i], MAXWAIT) == -1)
+				return -1;
+		return 0;
+	}
+	
+	nstr[0] = ' ';
+	nstr[1] = '$';
+	nstr[2] = NUL;
+	
+	/* most significant byte first */
+	for (i=3; i>=0; i--)
+		hexcat(nstr, num.b[i]);
+
+	return str_send(nstr);
 }
 
 /********************************************************
 **
-** vseek
+** vrdstart
 **
-** This is an interface to the Vinculum "SEK" command
-** (Seek).
+** Begin a streaming read of n bytes from the file opened
+** with vropen().  A single RDF command is issued for the
+** whole count; the data must then be collected with one
+** or more calls to vrdblk() and the stream finished with
+** vrdend().
 **
-** This routine seeks to an absolute offset position
-** in an open file. 
+** Returns:
+**		0	Success
+**		-1	I/O error
 **
 ********************************************************/
-vseek(p)
-int p;
+vrdstart(n)
+long n;
 {
-	static char fpos[7];
+	static long ln;
 	
-	str_send("sek ");
-	str_send(itoa(p, fpos));
-	str_send("\r");
-	return vprompt();
+	/* if vread() read ahead, back up to where the caller is */
+	if (vrnext < vrlen) {
+		ln = vfpos - (vrlen - vrnext);
+		if (vlseek(ln) == -1)
+			return -1;
+	}
+	vrlen = vrnext = 0;
+	vfpos += n;
+	if (vrleft >= 0L)
+		vrleft -= n;
+	
+	vleft = n;
+	
+	vcmd("rdf", S_RDF);
+	vnum(n);
+	return str_send("\r");
 }
 
 /********************************************************
 **
-** vclose
+** vrdblk
 **
-** This is an interface to the Vinculum "CLF" command
-** (Close File).
+** Read the next n bytes of a stream started by vrdstart()
+** into the provided buffer.  As in vread() the bytes are
+** taken by vinblk().
 **
-** This closes the specified file on the USB device.
-** This should be called after a vropen() and vread()
-** sequence, or a vwopen() and vwrite() sequence of calls.
+** Returns:
+**		0 on Success
+**		-1 if the VDIP stalled
 **
 ********************************************************/
-vclose(s)
-char *s;
+vrdblk(buff, n)
+char *buff;
+int n;
 {
-	str_send("clf ");
-	str_send(s);
-	str_send("\r");
-	return vprompt();
+	vleft -= n;
+	
+	return vinblk(buff, n);
 }
 
 /********************************************************
 **
-** vclf
+** vrdend
 **
-** This is an interface to the Vinculum "CLF" command
-** (Close File).
+** Finish a streaming read.  Any bytes of the stream that
+** the caller did not collect (e.g. after a local disk
+** error) are read and discarded so that the VDIP is left
+** at its prompt, which is then checked.
 **
-** This closes the currently open file on the USB device.
-** This should be called after a vropen() and vread()
-** sequence, or a vwopen() and vwrite() sequence of calls.
+** Returns:
+**		0 on Success
+**		-1 on Error
 **
 ********************************************************/
-vclf()
+vrdend()
 {
-	str_send("clf\r");
+	while (vleft > 0L) {
+		if (in_vwait(MAXWAIT) == -1)
+			return -1;
+		--vleft;
+	}
+	
 	return vprompt();
 }
 
 /********************************************************
 **
-** vipa
+** vwrstart
 **
-** This is an interface to the Vinculum "IPA" command
-** (Input In ASCII).
+** Begin a streaming write of n bytes to the file opened
+** with vwopen().  A single WRF command is issued for the
+** whole count; the data is then sent with one or more
+** calls to vwrblk() and the stream finished with vwrend().
 **
-** This routine ensures that the monitor’s mode for 
-** inputting and displaying values is printable ASCII
-** characters. 
+** Returns:
+**		0	Success
+**		-1	I/O error
 **
 ********************************************************/
-vipa()
+vwrstart(n)
+long n;
 {
-	str_send("ipa\r");
-	return vprompt();
+	/* vwrite() output goes first */
+	if (vwflush() == -1)
+		return -1;
+	vfpos += n;
+	vdname[0] = NUL;
+	
+	vleft = n;
+	
+	vcmd("wrf", S_WRF);
+	vnum(n);
+	return str_send("\r");
 }
 
 /********************************************************
 **
-** vread
-**
-** This is an interface to the Vinculum "RDF" command
-** (Read From File).
-**
-** This routine should only be called after a successful
-** call to vropen(), which opens a file on the device
-** for reading.  This routine reads n bytes from the file
-** on the USB device, storing them in the provided buffer.
-** Once all bytes have been written it then waits for the
-** VDIP to reply with the D:\> prompt which is read and
-** discarded.
+** vwrblk
 **
-** The bytes are read one at a time and a timeout value
-** (MAXWAIT) determines how long to wait before assuming
-** the command failed.
+** Send the next n bytes of a stream started by vwrstart().
+** Bytes beyond the count given to vwrstart() are ignored
+** since the VDIP would take them as a new command.
 **
 ** Returns:
 **		0 on Success
-**		-1 on Error
+**		-1 if the VDIP stalled
 **
 ********************************************************/
-vread(buff, n)
+vwrblk(buff, n)
 char *buff;
 int n;
 {
-	int i;
-	char *nxt;
-	static char fsize[7];
+	static long ln;
 	
-#ifdef DEBUG
-	printf("->vread\n");
-#endif
-	/* send read from file (RDF) command */
-	str_send("rdf ");
-	str_send(itoa(n, fsize));
-	str_send("\r");
+	ln = n;
+	if (ln > vleft)
+		n = vleft;
 	
-	/* immediately capture the result in the buffer */
-	nxt=buff;
-	for (i=0; i<n ; i++) {
-		/* wait for RX flag, then read the byte */
-		while ((inp(p_stat) & VRXF) == 0)
-			; /* wait... */
-		*nxt++ = inp(p_data);
-	}
-#ifdef DEBUG
-    printf("%d bytes read\n", n);
-#endif
-
-	return vprompt();
+	vleft -= n;
+	
+	return voutblk(buff, n);
 }
 
 /********************************************************
 **
-** vwrite
-**
-** This is an interface to the Vinculum "WRF" command
-** (Write To File).
+** vwrend
 **
-** This routine should only be called after a successful
-** call to vwopen(), which opens a file on the device
-** for writing.  This routine writes n bytes from the
-** provided buffer to the file on the USB device.  Once
-** all bytes have been written it then waits for the
-** VDIP to reply with the D:\> prompt which is read and
-** discarded
+** Finish a streaming write.  If the caller supplied fewer
+** bytes than promised to vwrstart() the remainder is
+** padded with CP/M EOF (^Z) characters, then the prompt
+** is checked.
 **
 ** Returns:
 **		0 on Success
 **		-1 on Error
 **
 ********************************************************/
-vwrite(buff, n)
-char *buff;
-int n;
+vwrend()
 {
-	int i, rc;
-	static char wsize[7];
-
-	rc = 0;
-	
-	/* write to file (WRF) command */
-	str_send("wrf ");
-	str_send(itoa(n, wsize));
-	str_send("\r");
-	
-	/* now output the n bytes to the device */
-	for (i=0; i<n; i++) {
-		out_v(*buff++);
+	vdname[0] = NUL;
+	while (vleft > 0L) {
+		if (out_vwait(CPMEOF, MAXWAIT) == -1)
+			return -1;
+		--vleft;
 	}
-
+	
 	return vprompt();
 }
 
@@ -1014,7 +2946,11 @@ char *dir;
 	
 	rc = 0;
 	
-	str_send("cd ");
+	/* the monitor won't change directory with a file open */
+	vsnone();
+	vdname[0] = NUL;
+	
+	vcmd("cd ", S_CD);
 	str_send(dir);
 	str_send("\r");
 	
@@ -1023,10 +2959,15 @@ char *dir;
 	*/
 	str_rdw(linebuff, '\r');
 
-	if (strcmp(linebuff, PROMPT) != 0) {
+	if (!visprompt(linebuff)) {
 		printf("CD %s: %s\n", dir, linebuff);
 		rc = -1;
+		/* unless it plainly failed, where it is is unknown */
+		if (!viscf(linebuff))
+			vcwdok = FALSE;
 	}
+	else
+		vcwdadd(dir);
 	
 	return rc;
 }
@@ -1035,15 +2976,22 @@ char *dir;
 **
 ** vcdroot
 **
-** Change the directory to be root ('/').  This is done
-** by issuing successive "CD .." commands until the command
-** fails.
+** Change the directory to be root ('/').  If the current
+** directory is known this takes one "CD .." per level,
+** otherwise "CD .." commands are issued until one fails.
 **
 ********************************************************/
 vcdroot()
 {
-	while(vcdup() == 0)
-		;
+	if (vcwdok) {
+		while (strcmp(vcwd, "/") != 0)
+			if (vcdup() == -1)
+				break;
+	}
+	else {
+		while(vcdup() == 0)
+			;
+	}
 }
 
 /********************************************************
@@ -1064,17 +3012,271 @@ vcdup()
 	
 	rc = 0;
 	
-	str_send("cd ..\r");
+	vsnone();
+	vdname[0] = NUL;
+	
+	vcmd("cd ", S_CD);
+	str_send("..\r");
 	
 	/* The result will either be the Prompt or
 	** "Command Failed". If the latter then return error.
 	*/
 	str_rdw(linebuff, '\r');
 
-	if (strcmp(linebuff, CFERROR) == 0) {
-		/* flag an error! */
+	if (visprompt(linebuff))
+		vcwdpop();
+	else if (viscf(linebuff)) {
+		/* flag an error! we must be at the root */
+		rc = -1;
+		strcpy(vcwd, "/");
+		vcwdok = TRUE;
+	}
+	else {
+		/* no answer or a garbled one: the monitor may or
+		** may not have moved
+		*/
 		rc = -1;
+		vcwdok = FALSE;
+	}
+	
+	return rc;
+}
+
+/********************************************************
+**
+** vcdabs
+**
+** Change to the absolute directory path, e.g.
+** "/GAMES/ZORK".  If the current directory is known only
+** the levels below the part the two paths have in common
+** are changed: from /GAMES/ADVENT it takes one "CD .."
+** and one "CD ZORK".  Otherwise vcdroot() is used first.
+** "." and ".." may be used in the path.
+**
+** Returns:
+**		0 if success
+**		-1 if fail (path too long, or a CD failed)
+**
+********************************************************/
+vcdabs(path)
+char *path;
+{
+	int i, k, n;
+	char *c, *d;
+	static char want[VPATH], dir[14];
+	
+	if (vcwdnorm(want, path) == -1)
+		return -1;
+	if (!vcwdok)
+		vcdroot();
+	
+	/* length of the leading directories in common */
+	k = 0;
+	for (i=0; (vcwd[i] == want[i]) && (vcwd[i] != NUL); i++)
+		if (vcwd[i] == '/')
+			k = i;
+	if (((vcwd[i] == NUL) || (vcwd[i] == '/')) &&
+		((want[i] == NUL) || (want[i] == '/')))
+		k = i;
+	
+	/* up a level for each directory after that */
+	n = 0;
+	for (c=vcwd+k; *c!=NUL; c++)
+		if ((*c == '/') && (c[1] != NUL))
+			n++;
+	while (n-- > 0)
+		if (vcdup() == -1)
+			return -1;
+	
+	/* and down through the rest of the new path */
+	for (c=want+k; *c!=NUL; ) {
+		while (*c == '/')
+			c++;
+		for (d=dir; (*c != '/') && (*c != NUL) && (d < dir+13); )
+			*d++ = *c++;
+		*d = NUL;
+		if ((dir[0] != NUL) && (vcd(dir) == -1))
+			return -1;
+	}
+	return 0;
+}
+
+/********************************************************
+**
+** vcdpath
+**
+** Change to the directory path, using '/' between levels.
+** A path starting with '/' is absolute, otherwise it is
+** relative to the current directory.  Relative paths are
+** worked out by vcdabs() when the current directory is
+** known, and otherwise taken a level at a time.
+**
+** Returns:
+**		0 if success
+**		-1 if fail
+**
+********************************************************/
+vcdpath(path)
+char *path;
+{
+	char *c, *d;
+	static char full[VPATH*2], dir[14];
+	
+	if (path[0] == '/')
+		return vcdabs(path);
+	
+	if (vcwdok) {
+		strcpy(full, vcwd);
+		strcat(full, "/");
+		strcat(full, path);
+		return vcdabs(full);
+	}
+	
+	for (c=path; *c!=NUL; ) {
+		for (d=dir; (*c != '/') && (*c != NUL) && (d < dir+13); )
+			*d++ = *c++;
+		*d = NUL;
+		while (*c == '/')
+			c++;
+		if ((dir[0] != NUL) && (vcd(dir) == -1))
+			return -1;
+	}
+	return 0;
+}
+
+/* vcwdnorm - put the absolute path s in d in the form
+** kept in vcwd: upper case, no "." or ".." and no empty
+** levels.  Returns -1 if it is too long.
+*/
+vcwdnorm(d, s)
+char *d, *s;
+{
+	int i, n;
+	char *c;
+	
+	strcpy(d, "/");
+	while (*s != NUL) {
+		while (*s == '/')
+			s++;
+		for (n=0; (s[n] != '/') && (s[n] != NUL); n++)
+			;
+		if (n == 0)
+			break;
+		if ((n == 2) && (s[0] == '.') && (s[1] == '.')) {
+			/* back up a level */
+			for (c=d+strlen(d); (c > d) && (*c != '/'); c--)
+				;
+			if (c == d)
+				c++;
+			*c = NUL;
+		}
+		else if ((n != 1) || (s[0] != '.')) {
+			if (strlen(d) + n + 1 >= VPATH)
+				return -1;
+			if (d[1] != NUL)
+				strcat(d, "/");
+			c = d + strlen(d);
+			for (i=0; i<n; i++)
+				*c++ = toupper(s[i]);
+			*c = NUL;
+		}
+		s += n;
+	}
+	return 0;
+}
+
+/* vcwdadd - note a successful "CD dir" in vcwd */
+vcwdadd(dir)
+char *dir;
+{
+	static char full[VPATH*2];
+	
+	if (!vcwdok)
+		return;
+	
+	strcpy(full, vcwd);
+	strcat(full, "/");
+	strcat(full, dir);
+	if (vcwdnorm(vcwd, full) == -1)
+		vcwdok = FALSE;
+}
+
+/* vcwdpop - note a successful "CD .." in vcwd */
+vcwdpop()
+{
+	vcwdadd("..");
+}
+
+/********************************************************
+**
+** vcwdld
+**
+** Take the current directory from the file name (on the
+** local default drive), as saved by vcwdsv() at the end
+** of an earlier run.  It is used only if the same volume
+** is inserted (see vidsum()), which costs a command.  The
+** monitor goes back to the root when the flash drive is
+** put in again or the VDIP is reset, which this can't
+** see, so it is for programs that offer it as an option.
+**
+** Returns:
+**		0 directory known
+**		-1 no file, or it was for another volume
+**
+********************************************************/
+vcwdld(name)
+char *name;
+{
+	int channel, rc;
+	
+	if ((channel = fopen(name, "rb")) == 0)
+		return -1;
+	
+	rc = -1;
+	if ((read(channel, &vcwdf, sizeof(vcwdf)) == sizeof(vcwdf)) &&
+		(vcwdf.path[0] == '/') &&
+		(vcwdf.volsum == vidsum())) {
+		strcpy(vcwd, vcwdf.path);
+		vcwdok = TRUE;
+		rc = 0;
+	}
+	fclose(channel);
+	
+	return rc;
+}
+
+/********************************************************
+**
+** vcwdsv
+**
+** Save the current directory, with the volume checksum,
+** in the file name for vcwdld().  If it isn't known the
+** file is removed.
+**
+** Returns:
+**		0 Success
+**		-1 Error
+**
+********************************************************/
+vcwdsv(name)
+char *name;
+{
+	int channel, rc;
+	
+	if (!vcwdok) {
+		unlink(name);
+		return -1;
 	}
 	
+	if ((channel = fopen(name, "wb")) == 0)
+		return -1;
+	
+	vcwdf.volsum = vidsum();
+	strcpy(vcwdf.path, vcwd);
+	rc = 0;
+	if (write(channel, &vcwdf, sizeof(vcwdf)) == -1)
+		rc = -1;
+	fclose(channel);
+	
 	return rc;
 }
@@ -0,0 +1,225 @@
+/********************************************************
+** vlog.c - file transfer timing log
+**
+** These routines keep a CSV record of each file moved to
+** or from the flash drive, to be loaded into a spreadsheet
+** instead of copying timings off the console by hand.  The
+** records are collected in memory and only written out by
+** logflush() at the end of the run, so the transfers
+** themselves aren't slowed down.  The log is appended to a
+** local file, or to a file on the flash drive if its name
+** starts with "USB:".  Each record is one line:
+**
+**	date,time,dir,name,bytes,ms,bytes_per_sec,block,status
+**
+** with the date and time from the CP/M 3 clock when the
+** record was made, dir GET or PUT, bytes the number moved
+** before the transfer ended, ms from vticks() in VINC (so
+** in whole seconds on CP/M 3) and status "ok", or "error"
+** for a transfer that failed part way.  A new log file
+** gets a heading line first.  If the buffer fills up
+** during a run it is flushed early.  Writing the log to the
+** flash drive drops the VDIR catalog, so VCAT must be
+** linked too.
+**
+** The following routines are defined here:
+**
+**  logset()
+**  logrec()
+**  logflush()
+**
+**	*** Valid for use only in CP/M 3 ***
+**
+** This code is designed for use with the Software Toolworks C/80
+** v. 3.1 compiler with the optional support for
+** floats and longs.  The compiler should be configured
+** to produce a Microsoft relocatable module (.REL file)
+** file which can (optionally) be stored in a library
+** (.LIB file) using the Microsoft LIB-80 Library Manager.
+** The Microsoft LINK-80 loader program is then used to
+** link this code, along with any other required modules,
+** with the main (calling) program.
+**
+********************************************************/
+#include "fprintf.h"
+
+#define	TRUE	1
+#define	FALSE	0
+#define	NUL		'\0'
+
+/* records kept in memory before they are written */
+#define	LOGBUF	1024
+
+#define	LOGHEAD	"date,time,dir,name,bytes,ms,bytes_per_sec,block,status\r\n"
+
+char logname[20];	/* log file, empty if not logging */
+char logbuf[LOGBUF];
+int loglen;
+
+/* date data structure expected by BDOS 105 */
+struct logdt {
+	unsigned date;
+	char hour;
+	char minute;
+} ldt;
+
+/********************************************************
+**
+** logset
+**
+** Start logging to the file name ("USB:" prefix for the
+** flash drive).
+**
+********************************************************/
+logset(name)
+char *name;
+{
+	strncpy(logname, name, 19);
+	logname[19] = NUL;
+	loglen = 0;
+}
+
+/********************************************************
+**
+** logrec
+**
+** Add a record for a transfer: dir is "GET" or "PUT",
+** name the file on the flash drive, size the bytes moved,
+** ms the time it took, bsize the block size used and rc
+** the transfer's result (0, or -1 if it failed).  Does
+** nothing unless logset() has been called.
+**
+********************************************************/
+logrec(dir, name, size, ms, bsize, rc)
+char *dir, *name;
+long size, ms;
+int bsize, rc;
+{
+	int seconds;
+	static int mydate[3];	/* day, month, year */
+	static long rate, n;
+	static char line[96];
+
+	if (logname[0] == NUL)
+		return;
+
+	/* bytes per second, per tenth of a second when it
+	** can be so that nothing overflows
+	*/
+	if (ms >= 100L)
+		rate = (size * 10L) / (ms / 100L);
+	else if (ms > 0L)
+		rate = (size * 1000L) / ms;
+	else
+		rate = 0L;
+
+	seconds = bdoshl(105, &ldt);
+	dodate(ldt.date, mydate);
+
+	line[0] = NUL;
+	n = mydate[2];
+	lognum(line, n, 4);
+	strcat(line, "-");
+	n = mydate[1];
+	lognum(line, n, 2);
+	strcat(line, "-");
+	n = mydate[0];
+	lognum(line, n, 2);
+	strcat(line, ",");
+	n = btod(ldt.hour);
+	lognum(line, n, 2);
+	strcat(line, ":");
+	n = btod(ldt.minute);
+	lognum(line, n, 2);
+	strcat(line, ":");
+	n = btod(seconds);
+	lognum(line, n, 2);
+	strcat(line, ",");
+	strcat(line, dir);
+	strcat(line, ",");
+	strcat(line, name);
+	strcat(line, ",");
+	lognum(line, size, 1);
+	strcat(line, ",");
+	lognum(line, ms, 1);
+	strcat(line, ",");
+	lognum(line, rate, 1);
+	strcat(line, ",");
+	n = bsize;
+	lognum(line, n, 1);
+	strcat(line, ",");
+	strcat(line, (rc == 0) ? "ok" : "error");
+	strcat(line, "\r\n");
+
+	if (loglen + strlen(line) > LOGBUF)
+		logflush();
+	strcpy(logbuf + loglen, line);
+	loglen += strlen(line);
+}
+
+/********************************************************
+**
+** logflush
+**
+** Append the records collected so far to the log file.
+**
+** Returns:
+**		0	Success (or nothing to do)
+**		-1	Error
+**
+********************************************************/
+logflush()
+{
+	int rc, isnew;
+	static long len;
+
+	if ((logname[0] == NUL) || (loglen == 0))
+		return 0;
+
+	if (index(logname, "USB:") == 0) {
+		/* OPW leaves the pointer at the end of the file */
+		isnew = (vdirf(logname+4, &len) == -1);
+		if (vwopen(logname+4) == -1)
+			rc = -1;
+		else {
+			rc = 0;
+			if (isnew)
+				rc = vwrite(LOGHEAD, strlen(LOGHEAD));
+			if (rc == 0)
+				rc = vwrite(logbuf, loglen);
+			if (vclose(logname+4) == -1)
+				rc = -1;
+		}
+		/* the directory has changed */
+		catdel();
+	}
+	else {
+		if (cfsize(logname) == 0L)
+			cfappend(logname, LOGHEAD, strlen(LOGHEAD));
+		rc = cfappend(logname, logbuf, loglen);
+	}
+
+	loglen = 0;
+	return rc;
+}
+
+/* lognum - append n in decimal to s, with leading zeros to
+** at least w digits
+*/
+lognum(s, n, w)
+char *s;
+long n;
+int w;
+{
+	static char d[12];
+	char *p;
+
+	p = d + 11;
+	*p = NUL;
+	do {
+		*--p = '0' + (n % 10L);
+		n /= 10L;
+		--w;
+	} while ((n != 0L) || (w > 0));
+	strcat(s, p);
+}
@@ -0,0 +1,149 @@
+/********************************************************
+** vprog.c - file transfer progress display
+**
+** These routines show the progress of a file transfer on
+** a single console line: percent done, bytes moved, the
+** transfer rate and an estimate of the time remaining.
+** The line is redrawn at most once every PRGINT
+** milliseconds of the clock behind vticks() in VINC, not
+** after every block: at 9600 baud writing the line takes
+** longer than moving the block it reports.  Between
+** redraws prgadd() only adds and compares; the percentage
+** is kept by pctadd() in VUTIL.
+**
+** Typical use:
+**
+**	prgset(filesize);
+**	for (each block of n bytes)
+**		prgadd(n);
+**	prgend();
+**
+** On CP/M 3 vinit() must have been called first.
+**
+** The following routines are defined here:
+**
+**  prgset()
+**  prgadd()
+**  prgend()
+**  prgshow()
+**
+** This code is designed for use with the Software Toolworks C/80
+** v. 3.1 compiler with the optional support for
+** floats and longs.  The compiler should be configured
+** to produce a Microsoft relocatable module (.REL file)
+** file which can (optionally) be stored in a library
+** (.LIB file) using the Microsoft LIB-80 Library Manager.
+** The Microsoft LINK-80 loader program is then used to
+** link this code, along with any other required modules,
+** with the main (calling) program.
+**
+********************************************************/
+#include "fprintf.h"
+
+#define	TRUE	1
+#define	FALSE	0
+
+/* minimum time between redraws, in milliseconds */
+#define	PRGINT	1000L
+
+/* declared in vinc library */
+long vticks();
+
+/* declared in vutil library */
+extern int pcdone;			/* percent done, see pctadd() */
+
+long prgtot;		/* bytes in the transfer */
+long prgdone;		/* bytes moved so far */
+long prgt0;			/* vticks() at the start */
+long prgnext;		/* vticks() due for the next redraw */
+int prgshown;		/* TRUE once the line has been drawn */
+
+/********************************************************
+**
+** prgset
+**
+** Start counting a transfer of total bytes.  Nothing is
+** shown until the first PRGINT has passed, so short
+** transfers produce no output at all.
+**
+********************************************************/
+prgset(total)
+long total;
+{
+	prgtot = total;
+	prgdone = 0L;
+	pctset(total);
+	prgt0 = vticks();
+	prgnext = prgt0 + PRGINT;
+	prgshown = FALSE;
+}
+
+/********************************************************
+**
+** prgadd
+**
+** Count n more bytes, redrawing the line if it is due.
+**
+********************************************************/
+prgadd(n)
+int n;
+{
+	static long now;
+
+	prgdone += n;
+	pctadd(n);
+	if ((now = vticks()) >= prgnext) {
+		prgshow(now);
+		prgnext = now + PRGINT;
+	}
+}
+
+/********************************************************
+**
+** prgend
+**
+** Finish the transfer: if the line was shown, draw it
+** once more with the final count and move to a new line.
+**
+********************************************************/
+prgend()
+{
+	if (prgshown) {
+		prgshow(vticks());
+		putchar('\n');
+	}
+}
+
+/********************************************************
+**
+** prgshow
+**
+** Draw the progress line as of time now (from vticks()).
+** The rate is worked out in tenths of a second so that
+** no product can overflow.
+**
+********************************************************/
+prgshow(now)
+long now;
+{
+	int sec;
+	static long t10, rate, eta;
+	static char fbytes[15], frate[10];
+
+	rate = 0L;
+	t10 = (now - prgt0) / 100L;
+	if (t10 > 0L)
+		rate = (prgdone / t10) * 10L;
+
+	commafmt(prgdone, fbytes, 15);
+	commafmt(rate, frate, 10);
+	printf("%3d%%  %s bytes  %s B/s", pcdone, fbytes, frate);
+	if (rate > 0L) {
+		eta = (prgtot - prgdone) / rate;
+		sec = eta % 60L;
+		printf("  ETA %ld:%02d", eta / 60L, sec);
+	}
+	/* blank out the tail of a longer previous line */
+	printf("    \r");
+	prgshown = TRUE;
+}
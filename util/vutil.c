@@ -29,7 +29,7 @@
 **
 ** http://www.ftdichip.com/Firmware/Precompiled/UM_VinculumFirmware_V205.pdf
 **
-** There are 29 utility routines defined here (see
+** There are 30 utility routines defined here (see
 ** comments in the code below for details on usage):
 **
 **  str_send()
@@ -42,6 +42,7 @@
 **  vfind_disk()
 **  vpurge()
 **  vhandshake()
+**  vecho()
 **  vinit()
 **  vsync()
 **  vdirf()
@@ -104,6 +105,12 @@ char *itoa();
 /* default max time (ms) to wait for prompt */
 #define	MAXWAIT	5000
 
+/* quiet time (ms) that ends a purge, and first handshake
+** timeout (ms) used by vsync()
+*/
+#define	DRAINMS	10
+#define	SYNCMS	4
+
 #define	TRUE	1
 #define	FALSE	0
 
@@ -370,7 +377,9 @@ unsigned t;
 ** This routine basically checks to see if two-way
 ** communication with the Command Monitor is working. It
 ** sends an ASCII 'E' and waits up to 't' microseconds
-** for the 'E' to be echoed back.
+** for the 'E' to be echoed back, then does the same with
+** a lower case 'e'.  A stale 'E' left over from earlier
+** can't pass for the second echo.
 **
 ** Returns:
 **		TRUE	if the Monitor responded in time
@@ -379,17 +388,34 @@ unsigned t;
 ********************************************************/
 vhandshake(t)
 unsigned t;
+{
+	return vecho("E\r", "E", t) && vecho("e\r", "e", t);
+}
+
+/********************************************************
+**
+** vecho
+**
+** Send the echo command cmd (e.g. "E\r") up to three
+** times until a line comes back within 't' microseconds,
+** and check that it is reply.
+**
+** Returns:
+**		TRUE	if the Monitor echoed reply
+**		FALSE	otherwise
+**
+********************************************************/
+vecho(cmd, reply, t)
+char *cmd, *reply;
+unsigned t;
 {
 	int i, done;
 	
 	for (done=FALSE, i=0; (i<3) && (!done); i++) {
-		str_send("E\r");
+		str_send(cmd);
 		done = (str_rdw(linebuff, '\r', t) == 0);
 	}
-	if (strcmp(linebuff,"E") == 0)
-		return TRUE;
-	else
-		return FALSE;
+	return done && (strcmp(linebuff, reply) == 0);
 }
 
 /********************************************************
@@ -436,7 +462,8 @@ vinit()
 **
 ** Flush the input buffer and attempt to handshake with
 ** the VDIP1 device.  This should put things in a known
-** state.
+** state.  The handshake timeout starts at a few ms and
+** is doubled on each failed attempt, up to MAXWAIT.
 **
 ** Returns:
 **		TRUE after successful synchronization
@@ -445,21 +472,17 @@ vinit()
 ********************************************************/
 vsync()
 {
-	int i, done;
+	unsigned t;
+	int done;
 	
-	/* try up to 3 times to sync */
-	for (i=0, done=FALSE; ((i<3) && (!done)); i++) {
+	/* start with a short handshake timeout and double it
+	** only while the device fails to answer
+	*/
+	for (t=SYNCMS, done=FALSE; ((t<=MAXWAIT) && (!done)); t <<= 1) {
 		/* first purge any waiting data */
-		vpurge(MAXWAIT);
+		vpurge(DRAINMS);
 	
-		if (vhandshake(MAXWAIT))
-			/* we're done! */
-			done = TRUE;
-		else {
-			/* sometimes it takes more time, try 2s ... */
-			printf("Synchronizing...\n");
-			wait(2);
-		}
+		done = vhandshake(t);
 	}
 	return done;
 }
@@ -17,17 +17,31 @@
 **	separated VUTIL and VINC into two compilable units
 **		5 Mar 2020
 **
+**	The BDOS routines are compiled only for CP/M (most of
+**	them only for CP/M 3), so the library also links on
+**	HDOS.  It must be compiled with the same HDOS, CPM2 or
+**	CPM3 define as VINC.
+**
 **	Glenn Roberts
 **	glenn.f.roberts@gmail.com
 **
 ********************************************************/
 #include "fprintf.h"
 
+/* Must define HDOS, CPM2 or CPM3 here to select the
+** appropriate compilation options (the same as in VINC).
+*/
+#define CPM3	1
+
 #define	NUL	'\0'
 
 /* declared in vinc library */
 extern char td_string[15];		/* time/date hex value */
 
+/* percent done of a transfer, see pctset() */
+long pcstep, pcnext, pcacc;
+int pcdone;
+
 /********************************************************
 **
 ** prndate
@@ -80,6 +94,7 @@ unsigned utime;
 	printf("%2d:%02d %s", hr, min, am_pm);
 }
 
+#ifndef HDOS
 /********************************************************
 **
 **	*** Valid for use only in CP/M ***
@@ -101,6 +116,288 @@ bdoshl() {
 #endasm
 }
 
+/********************************************************
+**
+**	*** Valid for use only in CP/M ***
+**
+** cfsize - Return the size in bytes of the named file
+**		as computed by BDOS function 35.  The result is
+**		always a whole number of 128-byte records.
+**
+********************************************************/
+long cfsize(name)
+char *name;
+{
+	int i;
+	char *l;
+	static char fcb[36];
+	static long fsize;
+	
+	makfcb(name, fcb);
+	bdos(35, fcb);
+	
+	/* random record field is a 3 byte count of records */
+	l = (char *) &fsize;
+	for (i=33; i<36; i++)
+		*l++ = fcb[i];
+	*l = 0;
+
+	return fsize * 128L;
+}
+#endif
+
+#ifdef CPM3
+/********************************************************
+**
+**	*** Valid for use only in CP/M 3 ***
+**
+** Direct BDOS sequential file I/O.  These bypass the C/80
+** stdio buffer: cfread() and cfwrite() move nrec (1-128)
+** 128-byte records between the caller's buffer and the
+** file with a single multi-sector call (BDOS 44), and
+** return the number of records actually moved.  fcb is a
+** 36 byte area supplied by the caller.  cfopen(), cfmake()
+** and cfclose() return 0, or -1 on error.
+**
+********************************************************/
+cfopen(name, fcb)
+char *name, *fcb;
+{
+	makfcb(name, fcb);
+	fcb[32] = 0;
+	return ((bdoshl(15, fcb) & 0xFF) == 0xFF) ? -1 : 0;
+}
+
+/* cfmake - create a file, replacing any existing one */
+cfmake(name, fcb)
+char *name, *fcb;
+{
+	makfcb(name, fcb);
+	bdos(19, fcb);
+	fcb[32] = 0;
+	return ((bdoshl(22, fcb) & 0xFF) == 0xFF) ? -1 : 0;
+}
+
+cfclose(fcb)
+char *fcb;
+{
+	return ((bdoshl(16, fcb) & 0xFF) == 0xFF) ? -1 : 0;
+}
+
+cfread(fcb, buff, nrec)
+char *fcb, *buff;
+int nrec;
+{
+	return cfxfer(20, fcb, buff, nrec);
+}
+
+cfwrite(fcb, buff, nrec)
+char *fcb, *buff;
+int nrec;
+{
+	return cfxfer(21, fcb, buff, nrec);
+}
+
+/* cfxfer - common part of cfread() and cfwrite() */
+cfxfer(func, fcb, buff, nrec)
+int func;
+char *fcb, *buff;
+int nrec;
+{
+	unsigned rc;
+	
+	bdos(26, buff);		/* DMA address */
+	bdos(44, nrec);		/* multi-sector count */
+	rc = bdoshl(func, fcb);
+	bdos(44, 1);		/* back to what stdio expects */
+	
+	if ((rc & 0xFF) == 0)
+		return nrec;
+	/* at EOF or error H holds the records moved */
+	return rc >> 8;
+}
+
+/********************************************************
+**
+**	*** Valid for use only in CP/M 3 ***
+**
+** cfappend - Add n bytes from buff to the end of the named
+**		text file, creating it if need be.  The last record
+**		is read back so that the text carries on at its
+**		first ^Z, and the new last record is padded with ^Z.
+**		Returns 0, or -1 on error.
+**
+********************************************************/
+cfappend(name, buff, n)
+char *name, *buff;
+int n;
+{
+	int k, rc;
+	unsigned recno;
+	static char fcb[36], rec[128];
+	
+	if ((cfopen(name, fcb) == -1) && (cfmake(name, fcb) == -1))
+		return -1;
+	
+	/* BDOS 35 gives the size in records */
+	bdos(35, fcb);
+	recno = (fcb[33] & 0xFF) | ((fcb[34] & 0xFF) << 8);
+	k = 0;
+	if (recno > 0) {
+		/* find the end of the text in the last record */
+		--recno;
+		if (cfrand(33, fcb, rec, recno) == -1) {
+			cfclose(fcb);
+			return -1;
+		}
+		while ((k < 128) && (rec[k] != 0x1A))
+			k++;
+		if (k == 128) {
+			++recno;
+			k = 0;
+		}
+	}
+	
+	rc = 0;
+	while ((n > 0) && (rc == 0)) {
+		rec[k++] = *buff++;
+		if ((--n == 0) || (k == 128)) {
+			cfpad(rec, k);
+			rc = cfrand(34, fcb, rec, recno++);
+			k = 0;
+		}
+	}
+	
+	if (cfclose(fcb) == -1)
+		rc = -1;
+	return rc;
+}
+
+/********************************************************
+**
+**	*** Valid for use only in CP/M 3 ***
+**
+** cfseek - Position an open file so that the next
+**		cfread() or cfwrite() starts at record recno, which
+**		may be the record just past the end of the file.
+**		A random read leaves the sequential position on the
+**		record it read, so the record before recno is read
+**		and then stepped over.  Returns 0, or -1 on error.
+**
+********************************************************/
+cfseek(fcb, recno)
+char *fcb;
+unsigned recno;
+{
+	static char rec[128];
+
+	if (recno == 0)
+		return 0;
+	if (cfrand(33, fcb, rec, recno-1) == -1)
+		return -1;
+	return (cfread(fcb, rec, 1) == 1) ? 0 : -1;
+}
+
+/* cfrand - random read (33) or write (34) of one record */
+cfrand(func, fcb, rec, recno)
+int func;
+char *fcb, *rec;
+unsigned recno;
+{
+	bdos(26, rec);
+	fcb[33] = recno & 0xFF;
+	fcb[34] = recno >> 8;
+	fcb[35] = 0;
+	return ((bdoshl(func, fcb) & 0xFF) == 0) ? 0 : -1;
+}
+
+/********************************************************
+**
+**	*** Valid for use only in banked CP/M 3 ***
+**
+** bmove - copy n bytes from src in memory bank sbank to
+**		dst in bank dbank with the BIOS XMOVE and MOVE
+**		entry points (bank 1 is the TPA).  The BIOS must
+**		support interbank moves; see the caller for a
+**		check.
+**
+********************************************************/
+bmove(dst, dbank, src, sbank, n)
+char *dst;
+int dbank;
+char *src;
+int sbank, n;
+{
+	static unsigned *wboot;
+	
+	/* 0001H holds the address of the BIOS WBOOT entry;
+	** XMOVE is entry 29 and MOVE entry 25, 3 bytes each
+	*/
+	wboot = 1;
+	bcall(*wboot + 84, (dbank << 8) | sbank, 0, 0);
+	bcall(*wboot + 72, n, src, dst);
+}
+
+/********************************************************
+**
+**	*** Valid for use only in CP/M ***
+**
+** bcall - Call the BIOS routine at addr with registers
+**		BC, DE and HL set from the arguments:
+**
+**		bcall(addr, bc, de, hl)
+**
+**		The routine's own RET comes back to our caller.
+**
+********************************************************/
+bcall() {
+#asm
+        LXI     H,8
+        DAD     SP
+        MOV     A,M
+        INX     H
+        MOV     H,M
+        MOV     L,A
+        PUSH    H
+        LXI     H,8
+        DAD     SP
+        MOV     C,M
+        INX     H
+        MOV     B,M
+        DCX     H
+        DCX     H
+        MOV     D,M
+        DCX     H
+        MOV     E,M
+        DCX     H
+        MOV     A,M
+        DCX     H
+        MOV     L,M
+        MOV     H,A
+        RET
+#endasm
+}
+#endif
+
+/********************************************************
+**
+** cfpad
+**
+** Pad the n bytes in buff out to a whole number of CP/M
+** records with ^Z (EOF) characters.  buff must have room.
+** Returns the number of records.
+**
+********************************************************/
+cfpad(buff, n)
+char *buff;
+int n;
+{
+	for (; (n % 128) != 0; n++)
+		buff[n] = 0x1A;
+	
+	return n / 128;
+}
+
 /********************************************************
 **
 ** btod
@@ -248,6 +545,52 @@ int len;
 	*s = NUL;
 }
 
+/********************************************************
+**
+** pctset
+**
+** Start a percent-done count for a transfer of total
+** bytes.  The one long division is done here so that
+** pctadd(), called for every block, only adds and
+** compares, and no product can overflow on large files.
+**
+********************************************************/
+pctset(total)
+long total;
+{
+	pcstep = total / 100L;
+	if (pcstep == 0L)
+		pcstep = 1L;
+	pcnext = pcstep;
+	pcacc = 0L;
+	pcdone = 0;
+}
+
+/********************************************************
+**
+** pctadd
+**
+** Count n more bytes of the transfer started by pctset().
+**
+** Returns:
+**		the new percentage, if it has changed
+**		-1 otherwise
+**
+********************************************************/
+pctadd(n)
+int n;
+{
+	int pct;
+	
+	pct = pcdone;
+	pcacc += n;
+	while ((pcacc >= pcnext) && (pcdone < 100)) {
+		pcdone++;
+		pcnext += pcstep;
+	}
+	return (pcdone == pct) ? -1 : pcdone;
+}
+
 /********************************************************
 **
 ** aotoi
@@ -375,8 +718,11 @@ is_leap(year) {
 	return (((year%4==0)&&((year%100)!=0)) || ((year%400)==0));
 }
 
+#ifdef CPM3
 /********************************************************
 **
+**	*** Valid for use only in CP/M 3 ***
+**
 ** settd
 **
 ** Reads time/date via BDOS and stores result in
@@ -420,6 +766,7 @@ settd()
 	hexcat(td_string, utime >> 8);
 	hexcat(td_string, utime & 0xFF);	
 }
+#endif
 
 /********************************************************
 **
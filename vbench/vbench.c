@@ -0,0 +1,415 @@
+/* vbench - VDIP throughput and latency benchmark
+**
+** This program measures what the FTDI Vinculum VDIP-1
+** (interfaced in parallel FIFO mode) and the flash drive
+** attached to it can do on this machine: the monitor's
+** prompt round trip, DIR and DIRT of a file, opening and
+** closing a file, and raw WRF and RDF throughput for block
+** sizes from 128 bytes to 16K.  It replaces timing copies
+** by hand with a stopwatch.
+**
+** A scratch file (VBENCH.TMP) is created on the flash drive
+** for the tests and deleted at the end.
+**
+** Usage: vbench <switches>
+**
+** switches:
+**		-p<port>	to specify octal port (default is 0331)
+**		-c			compact (short command set) protocol
+**		-d<n>		run each test for n seconds (1-9, default 5)
+**		-o			also append the results to VBENCH.CSV on
+**					the flash drive
+**
+** Each test repeats one operation, starting on a tick of
+** the clock behind vticks() in VINC, until at least the
+** test time has passed, and counts how many completed.
+** Counting whole operations over a fixed time keeps the
+** results good even with the one-second clock of CP/M 3.
+** The throughput tests use VINC's vwrf() and vrdf(), so
+** each block is exactly one WRF or RDF command and isn't
+** coalesced into sectors by vwrite().
+**
+** "Polls/op" is the number of status port polls per
+** operation spent waiting for the VDIP (see vrxspn and
+** vtxspn in VINC): a high figure means the VNC1L or the
+** flash drive is the bottleneck, a low one that the host
+** is.
+**
+** Compiled with Software Toolworks C/80 V. 3.1 with support for
+** floats and longs.  Typical link statement:
+**
+** vbench,pio,vinc32,vutil32,fprintf,stdlib/s,flibrary/s,clibrary,vbench/n/e
+**
+**	This code is OS agnostic - should compile
+**  and run on HDOS, CP/M 2.2 and CP/M 3.
+**
+*/
+
+/* FTDI VDIP default ports */
+#define VDATA	0331
+#define VSTAT	0332
+
+#define	FALSE	0
+#define	TRUE	1
+#define NUL '\0'
+
+#include "fprintf.h"
+
+/* files used on the flash drive */
+#define	SCRATCH	"VBENCH.TMP"
+#define	CSVFILE	"VBENCH.CSV"
+
+/* size of the scratch file, and the largest block */
+#define	FILESZ	65536L
+#define	MAXBLK	16384
+#define	MINBLK	128
+
+/* kinds of test */
+#define	T_PROMPT	0
+#define	T_DIR		1
+#define	T_DIRT		2
+#define	T_OPEN		3
+#define	T_WRITE		4
+#define	T_READ		5
+
+/* maximum number of results */
+#define	NRES	24
+
+/* USB i/o ports */
+int p_data;		/* USB data port */
+int p_stat;		/* USB status port */
+
+/* switch values */
+int tsecs;		/* seconds per test */
+int tocsv;		/* TRUE to append results to CSVFILE */
+
+/* declared in vinc library */
+extern int vcompact;	/* TRUE for SCS/IPH protocol */
+extern long vrxspn;		/* status polls waiting for RXF */
+extern long vtxspn;		/* status polls waiting for TXE */
+long vticks();
+
+long rate();
+
+/* results, in the order measured */
+char *rname[NRES];
+int rsize[NRES];
+long rops[NRES];
+long rms[NRES];
+long rspin[NRES];
+int nres;
+
+/* file position in the throughput tests */
+long bpos;
+
+/* block buffer */
+char buff[MAXBLK];
+
+/* process switches */
+dosw(argc, argv)
+int argc;
+char *argv[];
+{
+	int i;
+	char *s;
+
+	/* process right to left */
+	for (i=argc-1; i>0; i--) {
+		s = argv[i];
+		if (*s++ == '-') {
+			/* have a switch! */
+			switch (*s) {
+			case 'P':
+				++s;
+				p_data = aotoi(s);
+				p_stat = p_data + 1;
+			    break;
+			case 'C':
+				vcompact = TRUE;
+				break;
+			case 'D':
+				/* single digit seconds */
+				tsecs = *++s - '0';
+				if ((tsecs < 1) || (tsecs > 9))
+					tsecs = 5;
+				break;
+			case 'O':
+				tocsv = TRUE;
+				break;
+			default:
+			    printf("Invalid switch %c\n", *s);
+				break;
+			}
+		}
+	}
+}
+
+/* tstart - wait for the clock to tick, so that a test
+** starts on an edge, and return the time
+*/
+long tstart()
+{
+	static long t0;
+
+	t0 = vticks();
+	while (vticks() == t0)
+		;
+	return vticks();
+}
+
+/* oneop - do one operation of test kind, block size bs
+** return -1 on error
+*/
+oneop(kind, bs)
+int kind, bs;
+{
+	static long len;
+	static unsigned udate, utime;
+
+	switch (kind) {
+	case T_PROMPT:
+		/* an empty command line just gets the prompt */
+		str_send("\r");
+		return vprompt();
+	case T_DIR:
+		return vdirf(SCRATCH, &len);
+	case T_DIRT:
+		return vdird(SCRATCH, &udate, &utime);
+	case T_OPEN:
+		if (vropen(SCRATCH) == -1)
+			return -1;
+		return vclose(SCRATCH);
+	case T_WRITE:
+	case T_READ:
+		/* go round the scratch file */
+		if (bpos + bs > FILESZ) {
+			if (vlseek(0L) == -1)
+				return -1;
+			bpos = 0L;
+		}
+		bpos += bs;
+		if (kind == T_WRITE)
+			return vwrf(buff, bs);
+		return vrdf(buff, bs);
+	}
+	return -1;
+}
+
+/* measure - repeat test kind for tsecs seconds and record
+** the result under name; return -1 on error
+*/
+measure(name, kind, bs)
+char *name;
+int kind, bs;
+{
+	static long t0, now, ops, limit;
+
+	if (nres == NRES)
+		return -1;
+
+	limit = tsecs * 1000L;
+	ops = 0L;
+	vstclr();
+	t0 = tstart();
+	do {
+		if (oneop(kind, bs) == -1) {
+			printf("%s test failed\n", name);
+			return -1;
+		}
+		ops++;
+	} while (((now = vticks()) - t0) < limit);
+
+	rname[nres] = name;
+	rsize[nres] = bs;
+	rops[nres] = ops;
+	rms[nres] = now - t0;
+	rspin[nres] = vrxspn + vtxspn;
+	prtres(nres++);
+	return 0;
+}
+
+/* prtres - print result i as a line of the table */
+prtres(i)
+int i;
+{
+	static long x10, r;
+	static char fnum[15];
+
+	printf("%-8s", rname[i]);
+	if (rsize[i])
+		printf(" %6d", rsize[i]);
+	else
+		printf("      -");
+	printf(" %7ld", rops[i]);
+
+	/* ms per operation, to a tenth */
+	if (rops[i] == 0L)
+		printf("      -");
+	else {
+		x10 = (rms[i] * 10L) / rops[i];
+		printf(" %6ld.%ld", x10 / 10L, x10 % 10L);
+	}
+
+	if ((r = rate(i)) >= 0L) {
+		commafmt(r, fnum, 15);
+		printf(" %10s", fnum);
+	}
+	else
+		printf("          -");
+	if (rops[i] == 0L)
+		printf("        -\n");
+	else
+		printf(" %8ld\n", rspin[i] / rops[i]);
+}
+
+/* rate - bytes per second of result i; worked out per
+** tenth of a second so nothing overflows.  -1 if it has
+** no block size or took under a tenth of a second.
+*/
+long rate(i)
+int i;
+{
+	if ((rsize[i] == 0) || (rms[i] < 100L))
+		return -1L;
+	return (rops[i] * rsize[i] * 10L) / (rms[i] / 100L);
+}
+
+/* setup - create the scratch file at full size */
+setup()
+{
+	int i;
+
+	/* a leftover from an earlier run is simply replaced */
+	vdel(SCRATCH);
+	if (vwopen(SCRATCH) == -1)
+		return -1;
+	for (i=0; i<FILESZ/MAXBLK; i++)
+		if (vwrf(buff, MAXBLK) == -1)
+			return -1;
+	return vclose(SCRATCH);
+}
+
+/* lstr - decimal string for n */
+char *lstr(n)
+long n;
+{
+	static char s[12];
+	char *p;
+
+	p = s + 11;
+	*p = NUL;
+	do {
+		*--p = '0' + (n % 10L);
+		n /= 10L;
+	} while (n != 0L);
+	return p;
+}
+
+/* csvput - send string s to the open CSV file */
+csvput(s)
+char *s;
+{
+	return vwrite(s, strlen(s));
+}
+
+/* savecsv - append the results to CSVFILE */
+savecsv()
+{
+	int i, rc, isnew;
+	static long len, size;
+
+	isnew = (vdirf(CSVFILE, &len) == -1);
+	if (vwopen(CSVFILE) == -1)
+		return -1;
+
+	rc = 0;
+	if (isnew)
+		rc = csvput("test,block,ops,ms,bytes_per_sec,polls\r\n");
+	for (i=0; (i<nres) && (rc==0); i++) {
+		csvput(rname[i]);
+		csvput(",");
+		size = rsize[i];
+		csvput(lstr(size));
+		csvput(",");
+		csvput(lstr(rops[i]));
+		csvput(",");
+		csvput(lstr(rms[i]));
+		csvput(",");
+		size = rate(i);
+		csvput((size >= 0L) ? lstr(size) : "");
+		csvput(",");
+		csvput(lstr(rspin[i]));
+		rc = csvput("\r\n");
+	}
+
+	if (vclose(CSVFILE) == -1)
+		rc = -1;
+	return rc;
+}
+
+main(argc,argv)
+int argc;
+char *argv[];
+{
+	int bs, ok;
+
+	/* default values */
+	p_data = VDATA;
+	p_stat = VSTAT;
+	tsecs = 5;
+	tocsv = FALSE;
+	nres = 0;
+
+	/* process any switches */
+	dosw(argc, argv);
+
+	printf("VBENCH v1.0 - Using USB ports: %o,%o\n", p_data, p_stat);
+
+	if (vinit() == -1) {
+		printf("Error initializing VDIP-1 device!\n");
+		return;
+	}
+	if (vfind_disk() == -1) {
+		printf("No flash drive found!\n");
+		return;
+	}
+	if (setup() == -1) {
+		printf("Unable to create %s\n", SCRATCH);
+		return;
+	}
+
+	printf("%d seconds per test\n\n", tsecs);
+	printf("Test      Block     Ops    ms/op    Bytes/s  Polls/op\n");
+
+	ok = (measure("prompt", T_PROMPT, 0) == 0) &&
+		(measure("dir", T_DIR, 0) == 0) &&
+		(measure("dirt", T_DIRT, 0) == 0) &&
+		(measure("open", T_OPEN, 0) == 0);
+
+	/* write throughput, overwriting the scratch file */
+	if (ok && (vwopen(SCRATCH) == 0) && (vlseek(0L) == 0)) {
+		bpos = 0L;
+		for (bs=MINBLK; ok; bs <<= 1) {
+			ok = (measure("write", T_WRITE, bs) == 0);
+			if (bs == MAXBLK)
+				break;
+		}
+		vclose(SCRATCH);
+	}
+
+	/* read throughput */
+	if (ok && (vropen(SCRATCH) == 0)) {
+		bpos = 0L;
+		for (bs=MINBLK; ok; bs <<= 1) {
+			ok = (measure("read", T_READ, bs) == 0);
+			if (bs == MAXBLK)
+				break;
+		}
+		vclose(SCRATCH);
+	}
+
+	vdel(SCRATCH);
+
+	if (tocsv && (savecsv() == -1))
+		printf("Error writing %s\n", CSVFILE);
+}
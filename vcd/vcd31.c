@@ -10,7 +10,16 @@
 ** path (rooted), otherwise the path is taken as relative to
 ** the current directory.
 **
-** Version 3.1
+** switches:
+**		-p<port>	to specify octal port (default is 0331)
+**		-k			keep the current directory in VCD.DAT on
+**					the default drive from one run to the
+**					next, so that moving doesn't start by
+**					going up to the root.  Not safe if the
+**					flash drive is taken out between runs
+**					or the VDIP is reset.
+**
+** Version 3.2
 **
 ** Compiled with Software Toolworks C/80 V. 3.0
 **
@@ -21,6 +30,9 @@
 **	 enhancements to VDIP utility routines
 **   Modified to support all 3 OSs - gfr
 **			18 October 2019
+**	3.2	 move with as few CD commands as possible
+**		 (vcdpath in VINC), -k keeps the directory
+**		 between runs
 **
 **	This code is OS agnostic - should compile
 **  and run on HDOS, CP/M 2.2 and CP/M 3.  
@@ -38,12 +50,22 @@
 #define CFERROR "Command Failed"
 #define NUL '\0'
 
+/* where -k keeps the current directory */
+#define	CWDFILE	"VCD.DAT"
+
 #include "fprintf.h"
 
 /* USB i/o ports */
 int p_data;		/* USB data port */
 int p_stat;		/* USB status port */
 
+/* switch values */
+int keep;		/* TRUE to keep the directory between runs */
+
+/* declared in vinc library */
+extern char vcwd[];		/* current directory */
+extern int vcwdok;		/* TRUE if vcwd is known */
+
 /* process switches */
 dosw(argc, argv)
 int argc;
@@ -63,6 +85,9 @@ char *argv[];
 				p_data = aotoi(s);
 				p_stat = p_data + 1;
 			    break;
+			case 'K':
+				keep = TRUE;
+				break;
 			default:
 			    printf("Invalid switch %c\n", *s);
 				break;
@@ -75,43 +100,44 @@ main(argc,argv)
 int argc;
 char *argv[];
 {	
-	char *d, *s;
-	int slash;
+	int i;
 	
-	/* default port values */
+	/* default values */
 	p_data = VDATA;
 	p_stat = VSTAT;
+	keep = FALSE;
 
 	/* process any switches */
 	dosw(argc, argv);
+	
+	/* the directory is the first argument that isn't a switch */
+	for (i=1; (i < argc) && (*argv[i] == '-'); i++)
+		;
 
-	printf("VCD v3.1 - G. Roberts.  Using USB ports: %o,%o\n",
+	printf("VCD v3.2 - G. Roberts.  Using USB ports: %o,%o\n",
 		p_data, p_stat);
 				
 	if (vinit() == -1)
 		printf("Error initializing VDIP-1 device!\n");
 	else if (vfind_disk() == -1)
 		printf("No flash drive found!\n");
-	else if ((argc < 2) || (index(argv[1], "\\") != -1)) {
-		printf("Usage: vcd <directory>\n");
+	else if ((i >= argc) || (index(argv[i], "\\") != -1)) {
+		printf("Usage: vcd [-k] <directory>\n");
 		printf("Use forward slash (/) for directory specification\n");
 	}
 	else {
-		d = argv[1];
-		if (*d == '/') {
-			vcdroot();
-			++d;
-		}
-		slash = index(d, "/");
-		while (slash != -1) {
-			s = d;
-			d += slash;
-			*d++ = NUL;
-			vcd(s);
-			slash = index(d, "/");
-		}
-		if (strlen(d) > 0)
-			vcd(d);
+		if (keep)
+			vcwdld(CWDFILE);
+		
+		vcdpath(argv[i]);
+		if (vcwdok)
+			printf("Now in %s\n", vcwd);
+		
+		/* without -k the kept directory is now out of date */
+		if (keep)
+			vcwdsv(CWDFILE);
+		else
+			unlink(CWDFILE);
 	}
 }
 
@@ -4,9 +4,19 @@
 ** Vinculum VDP-1 interfaced in parallel FIFO mode.
 **
 ** It lists the files on the flash drive along with file size
-** and date of last modification.
+** and date of last modification.  The details are kept in a
+** catalog cache on the default drive (see VCAT) and reused
+** while the volume and its file names are unchanged.  The
+** cache is used in the root, or in any directory if VCD -K
+** has kept track of where the VDIP is.
 **
-** Version 1.5
+** switches:
+**		-p<port>	to specify octal port (default is 0331)
+**		-b			brief listing (names only)
+**		-c			compact (short command set) protocol
+**		-n			ignore the catalog cache
+**
+** Version 1.6
 **
 ** Compiled with Software Toolworks C/80 V. 3.0
 **
@@ -14,6 +24,9 @@
 **
 **	CP/M 3 revisions 31 May 2019 - gfr
 **
+**	1.6	Sizes and dates looked up one file ahead of the
+**		replies (vdirq/vdira in VINC)
+**
 */
 
 /* FTDI VDIP default ports */
@@ -24,7 +37,9 @@
 #define	TRUE	1
 
 #define	MAXD	256			/* maximum number of dir entries */
-#define PROMPT	"D:\\>"		/* standard VDIP command prompt */
+
+/* current directory kept by VCD -K */
+#define	CWDFILE	"VCD.DAT"
 #define	NUL		'\0'
 
 #include "fprintf.h"
@@ -37,9 +52,11 @@ int p_stat;		/* USB status port */
 
 /* switch values */
 int brief;		/* TRUE for brief listing */
+int nocache;	/* TRUE to ignore the catalog cache */
 
 /* declared in vutil library */
 extern char linebuff[128];		/* I/O line buffer 		*/
+extern int vcompact;			/* TRUE for SCS/IPH protocol */
 
 /* Internally-used file directory data structure.
 ** The 'tag' field is used to flag entries that
@@ -63,7 +80,7 @@ union u_fil {
 };
 
 /* array of pointers to directory entries */
-struct finfo *direntries[MAXD];
+struct finfo *direntry[MAXD];
 int nentries;
 
 /*********************************************
@@ -81,11 +98,8 @@ vdir1()
 	int i, ind, done;
 	struct finfo *entry;
 	
-	/* Issue directory command */
-	str_send("dir\r");
-	
-	/* the first line is always blank - toss it! */
-	str_rdw(linebuff, '\r');
+	/* Issue directory command (tosses the blank first line) */
+	vlist();
 
 	done = FALSE;
 	nentries = 0;
@@ -96,7 +110,7 @@ vdir1()
 	*/
 	do {
 		str_rdw(linebuff, '\r');
-		if (strcmp(linebuff, PROMPT) == 0)
+		if (visprompt(linebuff))
 			done = TRUE;
 		else if ((entry = alloc(sizeof(fentry))) == 0)
 			printf("error allocating directory entry!\n");
@@ -132,30 +146,55 @@ vdir1()
 
 /* vdir2 - This routine does "pass 2" of the directory 
 ** for each entry in the table it does a more extensive
-** query gathering file size and other information
+** query gathering file size and other information.  The
+** commands for the next file are queued with vdirq() while
+** the replies for the current one are read.
 */
 vdir2()
 {
-	int i;
-	static char dirtemp[20];
+	int i, j;
+	static char dirtemp[20], nexttemp[20];
+
+	/* subdirectories have no size or date */
+	for (i=0; i<nentries; i++)
+		if (direntry[i]->isdir) {
+			direntry[i]->size  = 0L;
+			direntry[i]->mdate = 0;
+			direntry[i]->mtime = 0;
+		}
 
-	for (i=0; i<nentries; i++){
-		/* return entry as a string, e.g. "HELLO.TXT" */
+	/* return entry as a string, e.g. "HELLO.TXT" */
+	if ((i = v2next(-1)) < nentries) {
 		dirstr(i, dirtemp);
+		vdirq(dirtemp);
+	}
+	while (i < nentries) {
+		/* keep the monitor busy with the next one */
+		if ((j = v2next(i)) < nentries) {
+			dirstr(j, nexttemp);
+			vdirq(nexttemp);
+		}
 		
 		/* look up the file size and date modified */
-		if (direntries[i]->isdir) {
-			direntries[i]->size  = 0L;
-			direntries[i]->mdate = 0;
-			direntries[i]->mtime = 0;
-		}
-		else {
-			vdirf(dirtemp, &direntries[i]->size);
-			vdird(dirtemp, &direntries[i]->mdate, &direntries[i]->mtime);
-		}
+		vdira(dirtemp, &direntry[i]->size,
+			&direntry[i]->mdate, &direntry[i]->mtime);
+		strcpy(dirtemp, nexttemp);
+		i = j;
 	}
 }
 
+/* v2next - return the index of the next file entry after
+** i, or nentries if there are no more.
+*/
+v2next(i)
+int i;
+{
+	for (i++; i<nentries; i++)
+		if (!direntry[i]->isdir)
+			break;
+	return i;
+}
+
 /* commafmt - create a string containing the representation
 ** of a long with commas every third position.  caution:
 ** len must be guaranteed big enough to hold any long.
@@ -224,10 +263,10 @@ dirstr(e, s)
 int e;
 char *s;
 {
-	strcpy(s,direntries[e]->name);
-	if (direntries[e]->ext[0] != 0) {
+	strcpy(s,direntry[e]->name);
+	if (direntry[e]->ext[0] != 0) {
 		strcat(s,".");
-		strcat(s,direntries[e]->ext);
+		strcat(s,direntry[e]->ext);
 	}
 }
 
@@ -265,6 +304,12 @@ char *argv[];
 			case 'B':
 				brief = TRUE;
 				break;
+			case 'C':
+				vcompact = TRUE;
+				break;
+			case 'N':
+				nocache = TRUE;
+				break;
 			default:
 			    printf("Invalid switch %c\n", *s);
 				break;
@@ -285,11 +330,12 @@ char *argv[];
 	p_stat = VSTAT;
 	
 	brief = FALSE;
+	nocache = FALSE;
 	
 	/* process any switches */
 	dosw(argc, argv);
 
-	printf("VDIR v1.5 (CP/M 3) - G. Roberts.  Using USB ports: %o,%o\n",
+	printf("VDIR v1.6 (CP/M 3) - G. Roberts.  Using USB ports: %o,%o\n",
 			p_data, p_stat);
 				
 	if (vinit() == -1)
@@ -297,12 +343,23 @@ char *argv[];
 	else if (vfind_disk() == -1)
 		printf("No flash drive found!\n");
 	else {
+		/* where the VDIP is, if VCD -K kept it; the
+		** catalog cache needs to know
+		*/
+		if (!brief && !nocache)
+			vcwdld(CWDFILE);
+		
 		/* pass 1 - populate the directory array */
 		vdir1();
 			
+		/* pass 2 - look up details on each file, unless
+		** the catalog cache already holds this directory
+		*/
 		if (!brief)
-			/* pass 2 - look up details on each file */
-			vdir2();
+			if (nocache || (catload(direntry, nentries) == -1)) {
+				vdir2();
+				catsave(direntry, nentries);
+			}
 			
 		/* now print the listing */
 		nfiles = 0;
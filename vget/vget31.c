@@ -20,13 +20,38 @@
 ** switches:
 **		-p<port>	to specify octal port (default is 0331)
 **		-v			"verbose" - continuous display of progress
+**		-c			compact (short command set) protocol
+**		-i<level>	interrupt-driven USB I/O on level 3-7 (CP/M
+**					2.2 only; needs VINC built with VINTR)
+**		-t			trace monitor commands, dump at exit (needs
+**					VINC built with VTRACE)
+**		-o<file>	append a CSV timing record to a local file, or
+**					USB:<file> on the stick (CP/M 3 only; link VLOG)
+**		-r			resume: a local file shorter than the source
+**					is taken to be an interrupted copy, and only
+**					the rest is fetched (CP/M 3 only)
 **
 ** Version 3.1	- Joint HDOS/CP/M3 release
 **
 ** Compiled with Software Toolworks C/80 V. 3.1 with support for
-** floats and longs.  Typical link statement:
+** floats and longs.  VINC and VUTIL must be compiled with the
+** same HDOS, CPM2 or CPM3 define as this file.  Typical link
+** statements:
 **
-** vget31,pio,vutil31,fprintf,stdlib/s,flibrary/s,clibrary,vget31/n/e
+** CP/M 3:
+** vget31,pio,vinc32,vutil32,vprog,vlog,vcat,fprintf,stdlib/s,flibrary/s,clibrary,vget31/n/e
+**
+** HDOS and CP/M 2.2 (no timing log):
+** vget31,pio,vinc32,vutil32,vprog,fprintf,stdlib/s,flibrary/s,clibrary,vget31/n/e
+**
+** With -I support add vint after vinc32 (CP/M 2.2 only).
+**
+** With -I the interrupt routine is only installed while the
+** file streams in, and nothing goes to the console then (so
+** -V shows no progress): a ^C warm boot would leave its
+** vector behind, and the BDOS only acts on ^C in console
+** calls.  HDOS can end the program on ^C at any moment, so
+** -I isn't offered there.
 **
 **	V1.1: Modified for separate compile & link - 5/21/16
 **	v1.2: Allow destination device specification.
@@ -34,6 +59,15 @@
 **	v3.1: Shared source for CP/M3 and HDOS 10/13/19 (gfr)
 **		Use #define HDOS, CPM2 or CPM3 to trigger
 **		appropriate compilations.
+**	v3.2: Stream the file with a single RDF command; now
+**		linked with the VINC and VUTIL libraries, which take
+**		the same OS define as VGET (VUTIL31 is not used).
+**		-I switch (link VINT after VINC).  On CP/M 3 the
+**		local file is written with multi-sector BDOS calls.
+**		-V progress shown at most once a second with rate
+**		and time left (link VPROG), for files of any size.
+**		-T command trace.  -O timing log on CP/M 3.
+**		-R on CP/M 3 carries on from a partial local copy.
 **
 ** Glenn Roberts 16 October 2019
 **
@@ -55,7 +89,6 @@
 #define	FALSE	0
 #define	TRUE	1
 
-#define BUFFSIZE	256
 #define FSLEN		20
 
 /* USB i/o ports - declared globally as these are
@@ -67,16 +100,125 @@ int p_stat;		/* USB status port */
 /* switch values */
 /* if verbose is TRUE then show progress updates */
 int verbose;
+/* USB board interrupt level, 0 for polled I/O */
+int ilevel;
+/* if tracing is TRUE dump the monitor command trace */
+int tracing;
+/* if resume is TRUE carry on from a partial local copy */
+int resume;
+
+/* declared in vinc library */
+extern int vcompact;	/* TRUE for SCS/IPH protocol */
+long vticks();
 
 /* source and destination filespecs */
 char srcfile[FSLEN], destfile[FSLEN];
 
+/* The local file is written with multi-sector BDOS calls
+** straight from the transfer buffer on CP/M 3, or through
+** stdio in 256 byte blocks elsewhere.
+*/
+#ifdef CPM3
+#define BUFFSIZE	4096	/* 32 CP/M records */
+#define RECSIZE		128
+char fcb[36];
+long cfsize();
+#else
+#define BUFFSIZE	256
+int channel;
+#endif
+
+/* vicheck - TRUE if interrupt-driven I/O can be used on
+** level ilevel.  vcp() installs it for the stream only.
+*/
+vicheck()
+{
+	if (vintr(ilevel) == -1)
+		return FALSE;
+	vpoll();
+	return TRUE;
+}
+
+/* lcreate - create the local file, -1 on error */
+lcreate(name)
+char *name;
+{
+#ifdef CPM3
+	return cfmake(name, fcb);
+#else
+	return ((channel = fopen(name, "wb")) == 0) ? -1 : 0;
+#endif
+}
+
+/* lpart - size in bytes of a partial local copy to carry
+** on from: 0 unless resuming on CP/M 3
+*/
+long lpart(name)
+char *name;
+{
+#ifdef CPM3
+	if (resume)
+		return cfsize(name);
+#endif
+	return 0L;
+}
+
+/* lappend - open the local file so that writing carries on
+** at byte pos, a whole number of records.  -1 on error.
+*/
+lappend(name, pos)
+char *name;
+long pos;
+{
+#ifdef CPM3
+	unsigned recno;
+	
+	recno = pos / RECSIZE;
+	if (cfopen(name, fcb) == -1)
+		return -1;
+	return cfseek(fcb, recno);
+#else
+	return -1;
+#endif
+}
+
+/* lwrite - write n bytes from buff (which holds BUFFSIZE)
+** to the local file, padding the last CP/M record with ^Z
+** or the last block with NULs.  -1 on error.
+*/
+lwrite(buff, n)
+char *buff;
+int n;
+{
+#ifdef CPM3
+	int nrec;
+	
+	nrec = cfpad(buff, n);
+	return (cfwrite(fcb, buff, nrec) == nrec) ? 0 : -1;
+#else
+	for (; n < BUFFSIZE; n++)
+		buff[n] = 0;
+	return (write(channel, buff, BUFFSIZE) == -1) ? -1 : 0;
+#endif
+}
+
+/* lclose - close the local file, -1 on error */
+lclose()
+{
+#ifdef CPM3
+	return cfclose(fcb);
+#else
+	fclose(channel);
+	return 0;
+#endif
+}
+
 /* vcp - copy from source file to dest file */
 vcp(source, dest)
 char *source, *dest;
 {
-	int nblocks, nbytes, i, channel;
-	static long filesize, pctdone;
+	int n, done, rc, werr, rerr;
+	static long filesize, left, bsize, t0, start, moved;
 	static char fsize[FSLEN], rwbuffer[BUFFSIZE];
 	
 	if (vdirf(source, &filesize) == -1)
@@ -84,52 +226,104 @@ char *source, *dest;
 	else {
 		commafmt(filesize, fsize, FSLEN);
 		printf("Copying %s to %s [ %s bytes ]\n", source, dest, fsize);
-	
-		/* bug: assumes file size < 8 meg */
-		nblocks = filesize/BUFFSIZE;
-		nbytes = filesize % BUFFSIZE;
+		
+		/* with -R a partial local copy is added to */
+		if (((start = lpart(dest)) > 0L) && (start >= filesize)) {
+			printf("%s is already copied\n", dest);
+			return;
+		}
+		if (start > 0L) {
+			commafmt(start, fsize, FSLEN);
+			printf("Resuming after %s bytes\n", fsize);
+		}
 		
 		/* open source file on flash device for read */
 		if (vropen(source) == -1)
 			printf("\nUnable to open source file %s\n", source);
-		else if	((channel = fopen(dest, "wb")) == 0)
-			printf("\nError opening destination file %s\n", dest);
 		else {
-			/* copy one block at a time */
-			for (i=1; i<=nblocks; i++) {
-				/* read a block from input file */
-				if (vread(rwbuffer, BUFFSIZE) == -1)
-					printf("\nError reading block %d\n", i);
-				else {
-					write(channel, rwbuffer, BUFFSIZE);
-					if (verbose) {
-						/* show user we're working ... */
-						pctdone = 100L * i/nblocks;
-						printf("Percent done: %ld\r", pctdone);
-					}
-				}
+			/* a single RDF streams the whole file; it is sent
+			** first so the VDIP fills its FIFO while the local
+			** file is created.
+			*/
+			t0 = vticks();
+			if ((start > 0L) && (vlseek(start) == -1)) {
+				printf("\nUnable to seek in %s\n", source);
+				vclose(source);
+				return;
 			}
-			/* NUL fill the buffer before last write */
-			for (i=0; i<BUFFSIZE; i++)
-				rwbuffer[i]=0;
-	
-			/* if any extra bytes process them ... */
-			if (nbytes > 0) {
-				/* read final remaining bytes */
-				if (vread(rwbuffer, nbytes) == -1)
-					printf("Error reading final block\n");
+			if (filesize > start) {
+				/* no console I/O until vpoll() */
+				if (ilevel != 0)
+					vintr(ilevel);
+				vrdstart(filesize - start);
+			}
+
+			if (start > 0L)
+				rc = lappend(dest, start);
+			else
+				rc = lcreate(dest);
+			if (rc == -1) {
+				/* discard the stream */
+				vrdend();
+				vpoll();
+				printf("\nError opening destination file %s\n", dest);
+				vclose(source);
+				return;
+			}
+
+			/* copy one block at a time; the FIFO bytes go
+			** straight into the buffer that is written out.
+			*/
+			bsize = BUFFSIZE;
+			prgset(filesize - start);
+			moved = 0L;
+			werr = rerr = FALSE;
+			for (left=filesize-start, done=FALSE; (left > 0L) && !done; ) {
+				n = (left < bsize) ? left : BUFFSIZE;
+				left -= n;
+				
+				/* a stalled VDIP is reported by vrdend() */
+				if (vrdblk(rwbuffer, n) == -1) {
+					rc = -1;
+					done = TRUE;
+				}
+				else if (lwrite(rwbuffer, n) == -1) {
+					werr = TRUE;
+					rc = -1;
+					done = TRUE;
+				}
 				else
-					write(channel, rwbuffer, BUFFSIZE);
-			}	
+					moved += n;
+				if (verbose && (ilevel == 0))
+					/* show user we're working ... */
+					prgadd(n);
+			}
 
-			/* close file on VDIP */
-			vclose(source);
-	
-			/* close output file */
-			fclose(channel);
+			/* collect the prompt that ends the stream */
+			if ((filesize > start) && (vrdend() == -1)) {
+				rerr = TRUE;
+				rc = -1;
+			}
+			vpoll();
+			if (werr)
+				printf("\nError writing to %s\n", dest);
+			if (rerr)
+				printf("\nError reading %s\n", source);
+#ifdef CPM3
+			logrec("GET", source, moved, vticks() - t0, BUFFSIZE, rc);
+#endif
+
+			/* close file on VDIP, and the output file while
+			** the VDIP is busy with that
+			*/
+			vqclose(source);
+			if (lclose() == -1)
+				printf("\nError closing %s\n", dest);
+			if (vsettle() == -1)
+				printf("\nError closing %s\n", source);
 			
 			if (verbose)
-				putchar('\n');
+				prgend();
 		}
 	}
 }
@@ -230,6 +424,9 @@ char *argv[];
 	p_data = VDATA;
 	p_stat = VSTAT;
 	verbose = FALSE;
+	ilevel = 0;
+	tracing = FALSE;
+	resume = FALSE;
 	
 	/* process right to left */
 	for (i=argc-1; i>1; i--) {
@@ -245,6 +442,24 @@ char *argv[];
 			case 'V':
 				verbose = TRUE;
 				break;
+			case 'C':
+				vcompact = TRUE;
+				break;
+			case 'I':
+				/* single digit level */
+				ilevel = *++s - '0';
+				break;
+			case 'T':
+				tracing = TRUE;
+				break;
+#ifdef CPM3
+			case 'O':
+				logset(++s);
+				break;
+			case 'R':
+				resume = TRUE;
+				break;
+#endif
 			default:
 			    printf("Invalid switch %c\n", *s);
 				break;
@@ -267,10 +482,24 @@ int errno;
 			break;
 		case 2:
 			/* general help */
-			printf("Usage: VGET usbfile <local> <-pxxx> <-v>\n");
+#ifdef CPM3
+			printf("Usage: VGET usbfile <local> <-pxxx> <-v> <-c> <-t> <-ofile> <-r>\n");
+#else
+			printf("Usage: VGET usbfile <local> <-pxxx> <-v> <-c> <-in> <-t>\n");
+#endif
 			printf("\tlocal is local drive and/or filespec\n");
 			printf("\txxx is USB optional port in octal (default is %o)\n", VDATA);
 			printf("\t-v specifies verbose mode\n");
+			printf("\t-c uses the compact (short command) protocol\n");
+#ifndef CPM3
+			printf("\t-in uses the USB board interrupt on level n (CP/M 2.2)\n");
+#endif
+			printf("\t-t dumps a trace of monitor commands at exit\n");
+#ifdef CPM3
+			printf("\t-ofile appends a timing record to file (USB:file\n");
+			printf("\t   for one on the flash drive)\n");
+			printf("\t-r resumes an interrupted copy\n");
+#endif
 			break;
 		case 3:
 			/* error initializing USB device */
@@ -280,6 +509,14 @@ int errno;
 			/* Flash drive inserted in USB device */
 			printf("No flash drive found!\n");
 			break;
+		case 5:
+			/* -I given but no interrupt support */
+			printf("Interrupt I/O not available on level %d\n", ilevel);
+			break;
+		case 6:
+			/* -T given but no trace support */
+			printf("Command trace not available\n");
+			break;
 	}
 }
 
@@ -301,10 +538,22 @@ char *argv[];
 		error(1);
 	else if (argc < 2)
 		error(2);
+	else if ((ilevel != 0) && !vicheck())
+		error(5);
+	else if (tracing && (vtron() == -1))
+		error(6);
 	else if (vinit() == -1)
 		error(3);
 	else if (vfind_disk() == -1)
 		error(4);
-	else
+	else {
 		vcp(srcfile, destfile);
+#ifdef CPM3
+		if (logflush() == -1)
+			printf("Error writing the timing log\n");
+#endif
+	}
+	
+	if (tracing)
+		vtrdump();
 }
@@ -15,7 +15,11 @@
 ** the directory data structure and tags the files that
 ** match the user's file specification; and finally, it
 ** processes the command (e.g. either copying the specified
-** files or listing their directory information).
+** files or listing their directory information).  For the
+** USB device only the names are read in the first phase;
+** size and date are looked up for tagged files only, when
+** a listing needs them, or read from the catalog cache
+** (see VCAT) if the directory is unchanged.
 **
 ** The program utilizes CP/M 3's real-time clock suport to
 ** time-and-date stamp file operations.
@@ -23,7 +27,11 @@
 ** The program can be run in line mode or command mode. In
 ** line mode the arguments are all specified on the command
 ** line.  In command mode the user is presented with a :V:
-** prompt and commands are executed interactively.
+** prompt and commands are executed interactively.  In
+** command mode the VDIP session and the USB directory are
+** kept between commands; they are rebuilt after an error,
+** when the flash drive is changed, and (for the directory)
+** only as far as needed after a file is written.
 **
 ** Usage: VPIP {command}
 **
@@ -43,6 +51,35 @@
 ** system devices.   USB to USB, and system to system copies
 ** are not supported.
 **
+** With the -S switch a command works on a whole tree in one
+** run: the current USB directory and all the subdirectories
+** below it, or all the user areas of a CP/M drive.  The
+** current user area goes with the current USB directory and
+** user area n with subdirectory USERn, which is made (MKD)
+** when files are copied to it.  Files from other USB
+** subdirectories go to the user area of their parent, and
+** each such subdirectory is named before the copy.  A
+** file that would land on one from another subdirectory
+** in the same user area is skipped with a warning; the
+** first one found (depth first) is the one copied.
+**
+** With the -R switch an interrupted copy is carried on
+** instead of started again.  A destination file shorter
+** than its source is taken to be a partial copy: the source
+** is positioned past the part already there (SEK on the USB
+** device, a random read on CP/M) and only the rest is sent.
+** A destination at least as long is left alone.  The files
+** aren't compared, so -R is only for repeating a command
+** that was cut short.
+**
+** On banked CP/M 3 -X<bank> stages transfers through 32K
+** of another memory bank (2-15).  VPIP overwrites that
+** bank from 1000H to 8FFFH without knowing what is there,
+** so it must not be one holding a RAM disk or the
+** directory and data buffers set up by GENCPM: VPIP asks
+** for confirmation before using it.  A wrong answer can
+** corrupt files.
+**
 ** This code is designed for use with the Software Toolworks C/80
 ** v. 3.1 compiler with the optional support for
 ** floats and longs.  The compiler should be configured
@@ -55,7 +92,7 @@
 **
 ** Typical link command:
 **
-** L80 vpip,vinc,vutil,pio,fprintf,stdlib/s,flibrary/s,clibrary,vpip/n/e
+** L80 vpip,vinc,vutil,vcat,vprog,vlog,pio,fprintf,stdlib/s,flibrary/s,clibrary,vpip/n/e
 **
 **	Glenn Roberts
 **	March 2020
@@ -63,6 +100,23 @@
 **	Revisions
 **
 **	3.2			Initial CP/M 3 version
+**	3.3			Stream each file with a single RDF/WRF command
+**				Local files moved with multi-sector BDOS calls
+**				-X<bank> stages transfers in a memory bank
+**				Progress line with rate and time left in place
+**				of a dot per block (VPROG)
+**				-T dumps a trace of monitor commands at exit
+**				(VINC built with VTRACE)
+**				-O<file> appends a CSV timing record for each
+**				file copied (VLOG)
+**				File sizes and dates looked up one file ahead
+**				of the replies (vdirq/vdira in VINC)
+**				New files known from the kept USB directory
+**				are opened without a seek to the start
+**				-S lists or copies a whole tree: USB
+**				subdirectories and CP/M user areas
+**				-R resumes partial copies: only the part of
+**				a file not already at the destination moves
 **
 ********************************************************/
 
@@ -151,6 +205,8 @@ struct finfo {
 	unsigned mdate;
 	unsigned mtime;
 	char tag;
+	char known;		/* size and date have been looked up */
+	char sdir;		/* subdirectory it is in, see sdpath() */
 }fentry;
 
 
@@ -162,6 +218,13 @@ struct finfo {
 
 /* declared in vinc library */
 extern char linebuff[128];		/* I/O line buffer 		*/
+extern int vcompact;			/* TRUE for SCS/IPH protocol */
+
+/* declared in vutil library */
+long cfsize();
+
+/* declared in vinc library */
+long vticks();
 
 char cmdline[80];
 char dstfname[15];
@@ -179,15 +242,59 @@ int nsrc;
 struct finfo *direntry[MAXD];
 int nentries;
 
+/* In interactive mode the VDIP session and the USB directory
+** are kept from one command to the next.  udir[] owns the USB
+** entries (direntry[] only borrows them) and udirok says
+** whether it is current.
+*/
+int vsess;					/* TRUE once vinit() has succeeded */
+struct finfo *udir[MAXD];
+int nudir;
+int udirok;
+
 /* buffer space for reading directory */
 char buffer[DIRBUFF];
 
-/* buffer used for read/write */
-#define BUFFSIZE	256
+/* buffer used for read/write: a whole number of CP/M
+** records, moved to or from disk in one BDOS call
+*/
+#define RECSIZE		128
+#define BUFFSIZE	4096
 char rwbuffer[BUFFSIZE];
 
+/* On banked CP/M 3 the -X<bank> switch stages transfers
+** through XBNBUF buffers (32K) at XBBASE in a spare memory
+** bank, so the flash drive and the local disk each get
+** long uninterrupted runs.  The TPA is bank 1.  Nothing
+** tells whether a bank is in use, so xbinit() asks.
+*/
+#define TPABANK		1
+#define XBBASE		0x1000
+#define XBNBUF		8
+int xbank;		/* staging bank, 0 if not used */
+
 /* global switch settings */
 int f_list;		/* to list directory (no file copy) */
+int tracing;	/* to dump the monitor command trace */
+int f_sub;		/* to work on subdirectories / user areas */
+int f_resume;	/* to carry on from partial copies */
+
+/* Subdirectories of a -S command.  sdpath() gives the path
+** of each from the starting USB directory, which is number
+** 0 ("/"); sdusr[] is the CP/M user area that goes with it.
+*/
+#define MAXSD	32			/* maximum number of subdirectories */
+#define SDLEN	64			/* longest subdirectory path */
+char sdpaths[MAXSD*SDLEN];
+int sdpar[MAXSD];			/* parent subdirectory */
+char sdusr[MAXSD];			/* CP/M user area */
+char sdmade[MAXSD];			/* TRUE once it is on the USB device */
+int nsd;
+int curd;					/* where the VDIP is, -1 if lost */
+int cpmusr;					/* user area at the start */
+int v2dir;					/* subdirectory vdir2() works on */
+char *sdpath();
+char *sdleaf();
 
 /* i/o ports - must be global, used by vinc utilities */
 int p_data;		/* USB data port */
@@ -208,6 +315,10 @@ char *argv[];
 	char *s;
 	
 	f_list = FALSE;
+	xbank = 0;
+	tracing = FALSE;
+	f_sub = FALSE;
+	f_resume = FALSE;
 
 	/* process right to left */
 	for (i=argc; i>0; i--) {
@@ -225,6 +336,30 @@ char *argv[];
 			case 'L':
 				f_list = TRUE;
 				break;
+			/* C = compact (SCS/IPH) protocol */
+			case 'C':
+				vcompact = TRUE;
+				break;
+			/* X = stage transfers in memory bank n */
+			case 'X':
+				xbank = atoi(++s);
+				break;
+			/* T = trace monitor commands */
+			case 'T':
+				tracing = TRUE;
+				break;
+			/* O = timing log */
+			case 'O':
+				logset(++s);
+				break;
+			/* S = include subdirectories */
+			case 'S':
+				f_sub = TRUE;
+				break;
+			/* R = resume partial copies */
+			case 'R':
+				f_resume = TRUE;
+				break;
 			default:
 			    printf("Invalid switch %c\n", *s);
 				break;
@@ -233,6 +368,47 @@ char *argv[];
 	}
 }
 
+/* xbinit - make sure the staging bank given with -X can
+** be used.  The user must confirm that it is free, since
+** 0x1000-0x8FFF of it is overwritten and the system can't
+** say what it holds.  Then two bytes are moved out to it
+** and back: if the BIOS can't move between banks the first
+** move lands in the TPA, which the probe detects.
+*/
+xbinit()
+{
+	static char probe1[2], probe2[2];
+	
+	if ((xbank < 2) || (xbank > 15))
+		xbank = 0;
+	else {
+		printf("Bank %d is overwritten from %xH to %xH.  It must not\n",
+			xbank, XBBASE, XBBASE + XBNBUF*BUFFSIZE - 1);
+		printf("hold a RAM disk or system buffers.  Is it free (Y/N)? ");
+		getline(cmdline, 80);
+		strupr(cmdline);
+		if (cmdline[0] != 'Y')
+			xbank = 0;
+	}
+	if (xbank) {
+		probe1[0] = 'A';
+		probe1[1] = 'B';
+		probe2[0] = 'x';
+		probe2[1] = 'y';
+		bmove(probe2, xbank, probe1, TPABANK, 2);
+		if ((probe2[0] != 'x') || (probe2[1] != 'y'))
+			xbank = 0;
+		else {
+			probe1[0] = probe1[1] = 'z';
+			bmove(probe1, TPABANK, probe2, xbank, 2);
+			if ((probe1[0] != 'A') || (probe1[1] != 'B'))
+				xbank = 0;
+		}
+	}
+	if (xbank == 0)
+		printf("Memory bank not usable, -X ignored\n");
+}
+
 /* freeall - free dynamically allocated space */
 freeall()
 {
@@ -242,9 +418,26 @@ freeall()
 	for (i=0; i<nsrc; i++)
 		free(src[i]);
 	
-	/* free directory entries */
-	for (i=0; i<nentries; i++)
-		free(direntry[i]);
+	/* free directory entries, except USB ones which are
+	** kept in udir[] for the next command
+	*/
+	if ((srctype != USBD) || f_sub)
+		for (i=0; i<nentries; i++)
+			free(direntry[i]);
+	nentries = 0;
+}
+
+/* freeudir - discard the USB directory model, e.g. after
+** an error or a change of disk.
+*/
+freeudir()
+{
+	int i;
+	
+	for (i=0; i<nudir; i++)
+		free(udir[i]);
+	nudir = 0;
+	udirok = FALSE;
 }
 
 
@@ -337,36 +530,56 @@ char *dname;
 
 /* bldudir - perform directory on the USB device and
 ** populate the directory array, dynamically allocating
-** memory for each entry.
+** memory for each entry.  Only the names are read here;
+** size and date are looked up later by vdir2(), and only
+** for the entries that were tagged.  The USB directory is
+** read only if the one kept from an earlier command is
+** no longer current.
 */
 bldudir()
 {
-	printf("Building USB directory...\n");
-	/* pass 1 - populate the directory array */
-	vdir1();
+	int i;
 	
-	printf("Cataloging USB file details...\n");
-	/* pass 2 - look up details on each file */
-	vdir2();
+	if (!udirok) {
+		printf("Building USB directory...\n");
+		/* pass 1 - populate the directory array */
+		vdir1();
+		udirok = TRUE;
+	}
+	
+	/* lend the entries to the working directory array */
+	for (i=0; i<nudir; i++) {
+		udir[i]->tag = FALSE;
+		direntry[i] = udir[i];
+	}
+	nentries = nudir;
 }
 
 /* vdir1 - This routine does "pass 1" of the directory
-** using the 'dir' command fill out the array of directory 
-** entries (direntry) by allocating space for each one
+** using the 'dir' command fill out the array of USB
+** directory entries (udir) by allocating space for each one
 */
 vdir1()
 {
-	int i, ind, done;
+	nudir = vdread(udir, 0, 0);
+}
+
+/* vdread - read the current USB directory into the entry
+** array tab, from index n on, noting subdirectory d in
+** each entry.  Returns the new number of entries.
+*/
+vdread(tab, n, d)
+struct finfo **tab;
+int n, d;
+{
+	int done, full;
 	struct finfo *entry;
 	
-	/* Issue directory command */
-	str_send("dir\r");
-	
-	/* the first line is always blank - toss it! */
-	str_rdw(linebuff, '\r');
+	/* Issue directory command (tosses the blank first line) */
+	vlist();
 
 	done = FALSE;
-	nentries = 0;
+	full = FALSE;
 	
 	/* read each line and add it to the list,
 	** when the D:\> prompt appears, we're done. the
@@ -374,64 +587,448 @@ vdir1()
 	*/
 	do {
 		str_rdw(linebuff, '\r');
-		if (strcmp(linebuff, "D:\\>") == 0)
+		if (visprompt(linebuff))
 			done = TRUE;
-		else if ((entry = alloc(sizeof(fentry))) == 0)
-			printf("error allocating directory entry!\n");
-		else {
-			/* process directory entry */
-			entry->name[0] = NUL;
-			entry->ext[0] = NUL;
-			entry->tag = FALSE;
-			entry->isdir = FALSE;
-			if ((ind=index(linebuff, " DIR")) != -1) {
-				/* have a directory entry */
-				entry->isdir = TRUE;
-				linebuff[ind] = 0;
-				strncpy(entry->name, linebuff, 8);
-				entry->name[8] = NUL;
-			} else if ((ind=index(linebuff, ".")) != -1) {
-				/* NAME.EXT filename */
-				linebuff[ind] = 0;
-				strncpy(entry->name, linebuff, 8);
-				entry->name[8] = NUL;
-				strncpy(entry->ext, linebuff+ind+1, 3);
-				entry->ext[3] = NUL;
-			} else {
-				/* NAME filename */
-				strncpy(entry->name, linebuff, 8);
-				entry->name[8] = NUL;
-			}
+		else if (n == MAXD)
+			/* no room, the rest is skipped */
+			full = TRUE;
+		else if ((entry = newentry(linebuff)) != 0) {
 			/* now store the entry and bump the count */
-			direntry[nentries++] = entry;
+			entry->sdir = d;
+			tab[n++] = entry;
 		}
 	} while (!done);
+	
+	/* the table is left full, which vcput() takes to mean
+	** it may not list every file
+	*/
+	if (full)
+		printf("Too many directory entries, some skipped\n");
+	return n;
 }
 
-/* vdir2 - This routine does "pass 2" of the directory 
-** for each entry in the table it does a more extensive
-** query gathering file size and other information
+/* bldutree - for -S, build the directory array from the
+** current USB directory and all the subdirectories below
+** it, depth first.  These entries are not kept for the
+** next command.
 */
-vdir2()
+bldutree()
+{
+	int i, j, d, sp, first, usr;
+	static int stack[MAXSD];
+	
+	printf("Building USB directory tree...\n");
+	nentries = 0;
+	sp = 0;
+	stack[sp++] = 0;
+	while (sp > 0) {
+		d = stack[--sp];
+		if (udmove(d) == -1)
+			break;
+		first = nentries;
+		nentries = vdread(direntry, nentries, d);
+		
+		/* push the subdirectories last first, so they are
+		** visited in listing order ("." and ".." are not
+		** followed)
+		*/
+		for (i=nentries-1; i>=first; i--) {
+			if (!direntry[i]->isdir || (direntry[i]->name[0] == '.'))
+				continue;
+			if ((usr = usrnum(direntry[i]->name)) == -1)
+				usr = sdusr[d];
+			if ((j = sdadd(d, direntry[i]->name, usr)) == -1)
+				printf("Too many subdirectories, %s skipped\n",
+					direntry[i]->name);
+			else
+				stack[sp++] = j;
+		}
+	}
+	udmove(0);
+}
+
+/* sdpath - return the path of subdirectory d */
+char *sdpath(d)
+int d;
+{
+	return sdpaths + d * SDLEN;
+}
+
+/* sdleaf - return the name of subdirectory d, the last
+** part of its path
+*/
+char *sdleaf(d)
+int d;
+{
+	return sdpath(d) + strlen(sdpath(sdpar[d])) + (sdpar[d] != 0);
+}
+
+/* sdinit - start a -S command with no subdirectories
+** but the starting one.
+*/
+sdinit()
+{
+	nsd = 1;
+	strcpy(sdpath(0), "/");
+	sdpar[0] = 0;
+	cpmusr = bdos(32, 0xFF);
+	sdusr[0] = cpmusr;
+	sdmade[0] = TRUE;
+	curd = 0;
+	v2dir = 0;
+}
+
+/* sdadd - add subdirectory name of subdirectory par, to
+** go with CP/M user area usr.  Returns its number, or -1
+** if there are too many or the path is too long.
+*/
+sdadd(par, name, usr)
+int par, usr;
+char *name;
+{
+	char *p;
+	
+	if ((nsd == MAXSD) ||
+		(strlen(sdpath(par)) + strlen(name) + 2 > SDLEN))
+		return -1;
+	
+	p = sdpath(nsd);
+	strcpy(p, sdpath(par));
+	if (par != 0)
+		strcat(p, "/");
+	strcat(p, name);
+	sdpar[nsd] = par;
+	sdusr[nsd] = usr;
+	sdmade[nsd] = FALSE;
+	return nsd++;
+}
+
+/* udmove - move the VDIP from the subdirectory it is in to
+** subdirectory d: up to the part of the two paths they
+** have in common and down from there (see vcdpath() in
+** VINC).  Returns -1 if it fails, after which the VDIP's
+** whereabouts are not known and it isn't moved again.
+*/
+udmove(d)
+int d;
+{
+	int i, k;
+	char *a, *b, *c;
+	static char rel[SDLEN*2];
+	
+	if (d == curd)
+		return 0;
+	if (curd == -1)
+		return -1;
+	
+	a = sdpath(curd);
+	b = sdpath(d);
+	
+	/* length of the leading directories in common */
+	k = 0;
+	for (i=0; (a[i] == b[i]) && (a[i] != NUL); i++)
+		if (a[i] == '/')
+			k = i;
+	if (((a[i] == NUL) || (a[i] == '/')) &&
+		((b[i] == NUL) || (b[i] == '/')))
+		k = i;
+	
+	/* ".." for each level of the rest of the current one,
+	** then the rest of the new one
+	*/
+	rel[0] = NUL;
+	for (c=a+k; *c!=NUL; c++)
+		if ((*c == '/') && (c[1] != NUL))
+			strcat(rel, "../");
+	c = b + k;
+	if (*c == '/')
+		c++;
+	strcat(rel, c);
+	
+	if (vcdpath(rel) == -1) {
+		printf("Lost track of the USB directory, use VCD\n");
+		curd = -1;
+		return -1;
+	}
+	curd = d;
+	return 0;
+}
+
+/* usrnum - return n if s is the name "USERn" of a CP/M
+** user area, otherwise -1.
+*/
+usrnum(s)
+char *s;
+{
+	int n;
+	
+	if ((index(s, "USER") != 0) || !isdigit(s[4]))
+		return -1;
+	n = atoi(s + 4);
+	return (n < 16) ? n : -1;
+}
+
+/* subgo - for -S, get ready to copy a file in subdirectory
+** d: select its CP/M user area and move the VDIP there,
+** first making the subdirectory if files are going to it.
+** Returns -1 if it can't be reached.
+*/
+subgo(d)
+int d;
+{
+	bdos(32, sdusr[d]);
+	
+	if ((dsttype == USBD) && !sdmade[d]) {
+		/* it is made in its parent, the name is the last
+		** part of its path.  If it's already there MKD
+		** fails, which doesn't matter.
+		*/
+		if (udmove(sdpar[d]) == -1)
+			return -1;
+		vmkd(sdleaf(d));
+		sdmade[d] = TRUE;
+		
+		/* the kept USB directory has changed */
+		freeudir();
+	}
+	return udmove(d);
+}
+
+/* subclash - for -S, check a copy from the USB device,
+** which flattens the tree into CP/M user areas: name each
+** subdirectory with files to copy that has no user area of
+** its own, and untag any file that would land on one from
+** an earlier subdirectory in the same user area.
+*/
+subclash()
+{
+	int i, j, d, di, dj;
+	static char iname[15], jname[15];
+	
+	for (d=1; d<nsd; d++) {
+		if (usrnum(sdleaf(d)) != -1)
+			continue;
+		for (i=0; i<nentries; i++)
+			if (direntry[i]->tag && !direntry[i]->isdir &&
+				(direntry[i]->sdir == d))
+				break;
+		if (i < nentries)
+			printf("%s is not a user area, its files go to user %d\n",
+				sdpath(d), sdusr[d]);
+	}
+	
+	for (i=0; i<nentries; i++) {
+		if (!direntry[i]->tag || direntry[i]->isdir)
+			continue;
+		di = direntry[i]->sdir;
+		dstexpand(direntry[i], &dstspec, iname);
+		for (j=0; j<i; j++) {
+			dj = direntry[j]->sdir;
+			if (!direntry[j]->tag || direntry[j]->isdir ||
+				(dj == di) || (sdusr[dj] != sdusr[di]))
+				continue;
+			dstexpand(direntry[j], &dstspec, jname);
+			if (strcmp(iname, jname) == 0)
+				break;
+		}
+		if (j < i) {
+			printf("%s in %s skipped, same name in user %d as in %s\n",
+				iname, sdpath(di), sdusr[di], sdpath(dj));
+			direntry[i]->tag = FALSE;
+		}
+	}
+}
+
+/* subdetail - for -S, look up the size and date of the
+** tagged files one subdirectory at a time.
+*/
+subdetail()
+{
+	int d;
+	
+	printf("Cataloging USB file details...\n");
+	for (d=0; d<nsd; d++) {
+		v2dir = d;
+		if ((v2next(-1) < nentries) && (udmove(d) == 0))
+			vdir2();
+	}
+	v2dir = 0;
+}
+
+/* subdone - for -S, go back to the starting USB directory
+** and CP/M user area.
+*/
+subdone()
+{
+	if (udmove(0) == -1) {
+		/* the VDIP is somewhere else now */
+		freeudir();
+		catdel();
+	}
+	bdos(32, cpmusr);
+}
+
+/* newentry - allocate a USB directory entry for the name
+** s as it appears in a 'dir' listing ("NAME.EXT", "NAME"
+** or "NAME DIR").  s is modified.  Size and date are
+** zeroed and marked as not yet looked up.
+*/
+newentry(s)
+char *s;
+{
+	int ind;
+	struct finfo *entry;
+	
+	if ((entry = alloc(sizeof(fentry))) == 0) {
+		printf("error allocating directory entry!\n");
+		return 0;
+	}
+	
+	/* process directory entry */
+	entry->name[0] = NUL;
+	entry->ext[0] = NUL;
+	entry->tag = FALSE;
+	entry->isdir = FALSE;
+	entry->size = 0L;
+	entry->mdate = 0;
+	entry->mtime = 0;
+	entry->known = FALSE;
+	entry->sdir = 0;
+	if ((ind=index(s, " DIR")) != -1) {
+		/* have a directory entry */
+		entry->isdir = TRUE;
+		s[ind] = 0;
+		strncpy(entry->name, s, 8);
+		entry->name[8] = NUL;
+	} else if ((ind=index(s, ".")) != -1) {
+		/* NAME.EXT filename */
+		s[ind] = 0;
+		strncpy(entry->name, s, 8);
+		entry->name[8] = NUL;
+		strncpy(entry->ext, s+ind+1, 3);
+		entry->ext[3] = NUL;
+	} else {
+		/* NAME filename */
+		strncpy(entry->name, s, 8);
+		entry->name[8] = NUL;
+	}
+	return entry;
+}
+
+/* uinval - note that the USB file s has been written: its
+** entry in the kept USB directory (if any) is marked for
+** a fresh size/date lookup, or added if it is new.
+*/
+uinval(s)
+char *s;
 {
 	int i;
+	struct finfo *entry;
 	static char dirtemp[20];
+	
+	if (!udirok)
+		return;
+	
+	if ((i = ulook(s)) != -1) {
+		udir[i]->known = FALSE;
+		return;
+	}
+	
+	/* a new file */
+	strcpy(dirtemp, s);
+	if ((nudir < MAXD) && ((entry = newentry(dirtemp)) != 0))
+		udir[nudir++] = entry;
+	else
+		/* can't track it, read the directory again */
+		freeudir();
+}
 
-	for (i=0; i<nentries; i++){
-		/* return entry as a string, e.g. "HELLO.TXT" */
+/* ulook - return the index in the kept USB directory of
+** the file s, or -1 if it isn't there.
+*/
+ulook(s)
+char *s;
+{
+	int i;
+	static char dirtemp[20];
+	
+	for (i=0; i<nudir; i++) {
+		udirstr(udir[i], dirtemp);
+		if (strcmp(dirtemp, s) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* vdir2 - This routine does "pass 2" of the directory 
+** for each tagged file entry in the table it does a more
+** extensive query gathering file size and other information.
+** Untagged entries and subdirectories are left zeroed by
+** vdir1() since nothing will look at them, and entries
+** already looked up by an earlier command are skipped.
+** The commands for the next entry are queued with vdirq()
+** while the replies for the current one are read.  Only
+** entries in subdirectory v2dir (the current one) are
+** looked up.  Returns TRUE if every file entry is now
+** known.
+*/
+vdir2()
+{
+	int i, j, all;
+	static char dirtemp[20], nexttemp[20];
+
+	all = TRUE;
+	for (i=0; i<nentries; i++)
+		if (!direntry[i]->isdir && !direntry[i]->known && !direntry[i]->tag)
+			all = FALSE;
+
+	/* return entry as a string, e.g. "HELLO.TXT" */
+	if ((i = v2next(-1)) < nentries) {
 		dirstr(i, dirtemp);
+		vdirq(dirtemp);
+	}
+	while (i < nentries) {
+		/* keep the monitor busy with the next one */
+		if ((j = v2next(i)) < nentries) {
+			dirstr(j, nexttemp);
+			vdirq(nexttemp);
+		}
 		
 		/* look up the file size and date modified */
-		if (direntries[i]->isdir) {
-			direntries[i]->size  = 0L;
-			direntries[i]->mdate = 0;
-			direntries[i]->mtime = 0;
-		}
-		else {
-			vdirf(dirtemp, &direntries[i]->size);
-			vdird(dirtemp, &direntries[i]->mdate, &direntries[i]->mtime);
-		}
+		vdira(dirtemp, &direntry[i]->size,
+			&direntry[i]->mdate, &direntry[i]->mtime);
+		direntry[i]->known = TRUE;
+		strcpy(dirtemp, nexttemp);
+		i = j;
 	}
+	return all;
+}
+
+/* v2next - return the index of the next entry after i
+** that vdir2() must look up, or nentries if there are no
+** more.
+*/
+v2next(i)
+int i;
+{
+	for (i++; i<nentries; i++)
+		if (direntry[i]->tag && !direntry[i]->isdir &&
+			!direntry[i]->known && (direntry[i]->sdir == v2dir))
+			break;
+	return i;
+}
+
+/* udetail - return TRUE if size and date are known for
+** all tagged file entries.
+*/
+udetail()
+{
+	int i;
+	
+	for (i=0; i<nentries; i++)
+		if (direntry[i]->tag && !direntry[i]->isdir && !direntry[i]->known)
+			return FALSE;
+	return TRUE;
 }
 
 /* vcput - copy from source file to VDIP dest file 
@@ -440,47 +1037,124 @@ vdir2()
 vcput(source, dest)
 char *source, *dest;
 {
-	int i, nbytes, channel, done, result, rc;
-	static long fsize;
+	int j, nb, nrec, done, rc;
+	static long fsize, total, t0, start, usize;
+	static char fcb[36];
+	static int nrecs[XBNBUF];
+	union u_fil ul;
+	
+	/* size the file (a directory scan) before the first
+	** VDIP command, while the monitor may still be closing
+	** the previous file.
+	*/
+	total = cfsize(source);
+	
+	/* a file that isn't in the kept USB directory is new,
+	** so VINC can leave out the seek to its start (with -S
+	** only while in the starting directory, which it is of).
+	** A directory of MAXD entries may have been cut off by
+	** vdread(), so then nothing is assumed.
+	*/
+	if (udirok && (nudir < MAXD) && (!f_sub || (curd == 0)) &&
+		(ulook(dest) == -1))
+		vdnone(dest);
+	
+	/* with -R a partial copy on the stick is carried on
+	** from its last whole record; the bytes after it are
+	** sent again.
+	*/
+	start = 0L;
+	if (f_resume && (vdirf(dest, &usize) == 0)) {
+		if (usize >= total) {
+			printf("%s already copied\n", dest);
+			return 0;
+		}
+		start = (usize / RECSIZE) * RECSIZE;
+	}
 	
 	rc = 0;
-	if((channel = fopen(source, "rb")) == 0) {
+	if (cfopen(source, fcb) == -1) {
 		printf("Unable to open source file %s\n", source);
 		rc = -1;
 	}
 	else if (vwopen(dest) == -1) {
 		printf("Unable to open destination file %s\n", dest);
 		rc = -1;
-		fclose(channel);
+		cfclose(fcb);
 	}
 	else {
-		/* start writing at beginning of file */
-		vseek(0);
+		/* start writing at beginning of file, or where
+		** the partial copy stops
+		*/
+		ul.l = start / RECSIZE;
+		if ((vlseek(start) == -1) || (cfseek(fcb, ul.i[0]) == -1)) {
+			printf("Unable to resume %s\n", dest);
+			vclose(dest);
+			cfclose(fcb);
+			return -1;
+		}
+		
+		/* a single WRF streams the whole file */
+		t0 = vticks();
+		if (total > start)
+			vwrstart(total - start);
+
 		fsize = 0L;
-		printf("%s --> %s\n", source, dest);
-		for (i=1, done=FALSE; !done; fsize+=nbytes, i++) {
-			nbytes = read(channel, rwbuffer, BUFFSIZE);
-			if (nbytes == 0)
-				done = TRUE;
-			else {
-				result = vwrite(rwbuffer, nbytes);
-				if (result == -1) {
-					printf("\nError writing to VDIP device\n");
+		if (start > 0L)
+			printf("%s --> %s (from %ld)\n", source, dest, start);
+		else
+			printf("%s --> %s\n", source, dest);
+		prgset(total - start);
+		/* the BDOS reads a buffer of records in one call
+		** and the buffer goes straight to the FIFO.  With
+		** a staging bank several buffers are read from disk
+		** first, then all sent together.
+		*/
+		for (done=FALSE; !done; ) {
+			for (nb=0; (nb < (xbank ? XBNBUF : 1)) && !done; nb++) {
+				nrec = cfread(fcb, rwbuffer, BUFFSIZE/RECSIZE);
+				if (nrec < BUFFSIZE/RECSIZE)
+					/* end of file */
+					done = TRUE;
+				/* a move of 0 bytes would be one of 64K */
+				if (xbank && (nrec > 0))
+					bmove(XBBASE + nb*BUFFSIZE, xbank,
+						rwbuffer, TPABANK, nrec*RECSIZE);
+				nrecs[nb] = nrec;
+			}
+			for (j=0; j<nb; j++) {
+				if ((nrec = nrecs[j]) == 0)
+					break;
+				if (xbank)
+					bmove(rwbuffer, TPABANK,
+						XBBASE + j*BUFFSIZE, xbank, nrec*RECSIZE);
+				/* a stalled VDIP is reported by vwrend() */
+				if (vwrblk(rwbuffer, nrec*RECSIZE) == -1) {
 					rc = -1;
 					done = TRUE;
-				} else {
-					/* show user we're working ... */
-					putchar('.');
-					if ((i%60) == 0)
-						printf("\n");
+					break;
 				}
+				fsize += nrec*RECSIZE;
+				/* show user we're working ... */
+				prgadd(nrec*RECSIZE);
 			}
 		}
-		printf("\n%ld bytes\n", fsize);
 		
-		/* important - close files! */
-		fclose(channel);
-		vclose(dest);
+		/* collect the prompt that ends the stream */
+		if ((total > start) && (vwrend() == -1)) {
+			printf("\nError writing to VDIP device\n");
+			rc = -1;
+		}
+		prgend();
+		printf("%ld bytes\n", fsize);
+		logrec("PUT", dest, fsize, vticks() - t0, BUFFSIZE, rc);
+		
+		/* important - close files!  The VDIP's close is
+		** finished while the next file is being opened;
+		** copyfiles() checks it with vsettle().
+		*/
+		vqclose(dest);
+		cfclose(fcb);
 	}
 	return rc;
 }
@@ -494,10 +1168,18 @@ dirstr(e, s)
 int e;
 char *s;
 {
-	strcpy(s,direntry[e]->name);
-	if (direntry[e]->ext[0] != 0) {
+	udirstr(direntry[e], s);
+}
+
+/* udirstr - same as dirstr() for an entry pointer */
+udirstr(entry, s)
+struct finfo *entry;
+char *s;
+{
+	strcpy(s,entry->name);
+	if (entry->ext[0] != 0) {
 		strcat(s,".");
-		strcat(s,direntry[e]->ext);
+		strcat(s,entry->ext);
 	}
 }
 
@@ -513,8 +1195,54 @@ char *s;
 */
 bldcdir(device)
 char *device;
+{
+	nentries = 0;
+	cscan(device);
+}
+
+/* bldctree - for -S, build the directory array from all
+** the CP/M user areas of device: the current one goes with
+** the starting USB directory and each other one that has
+** files with subdirectory USERn.
+*/
+bldctree(device)
+char *device;
+{
+	int i, u, d, first;
+	char *c;
+	static char uname[8];
+	
+	nentries = 0;
+	for (u=0; u<16; u++) {
+		bdos(32, u);
+		first = nentries;
+		cscan(device);
+		if (nentries == first)
+			continue;
+		
+		d = 0;
+		if (u != cpmusr) {
+			strcpy(uname, "USER");
+			c = uname + 4;
+			if (u >= 10)
+				*c++ = '1';
+			*c++ = '0' + u % 10;
+			*c = NUL;
+			d = sdadd(0, uname, u);
+		}
+		for (i=first; i<nentries; i++)
+			direntry[i]->sdir = d;
+	}
+	bdos(32, cpmusr);
+}
+
+/* cscan - add the files of device in the current user area
+** to the directory array
+*/
+cscan(device)
+char *device;
 {	
-	int i, j, bfn;
+	int i, j, bfn, full;
 	char c;
 	struct finfo *entry;
 	static char fcb[36];
@@ -534,13 +1262,15 @@ char *device;
 	*/
 	dmaentry = (struct finfo *) DMA;
 
-	nentries = 0;
-	
 	/* use BDOS functions 17 and 18 to scan directory */
+	full = FALSE;
 	bfn=17;
 	while ((i = bdos(bfn,fcb)) != -1) {
 		/* have a match */
-		if ((entry = alloc(sizeof(fentry))) == 0)
+		if (nentries == MAXD)
+			/* no room, the rest is skipped */
+			full = TRUE;
+		else if ((entry = alloc(sizeof(fentry))) == 0)
 			printf("Error allocating directory entry!\n");
 		else {
 			ourentry = &dmaentry[i];
@@ -563,12 +1293,15 @@ char *device;
 			
 			entry->tag = FALSE;
 			entry->isdir = FALSE;
+			entry->sdir = 0;
 			
 			/* now store the entry and bump the count */
 			direntry[nentries++] = entry;
 		}
 		bfn = 18;
 	}
+	if (full)
+		printf("Too many files, some skipped\n");
 }
 
 
@@ -578,8 +1311,10 @@ char *device;
 vcp(source, dest)
 char *source, *dest;
 {
-	int nblocks, nbytes, i, channel, rc, done;
-	static long filesize;
+	int n, last, nb, j, nrec, rc, done;
+	static long filesize, left, bsize, t0, start, moved;
+	static char fcb[36];
+	union u_fil ul;
 	
 	rc = 0;
 	if (vdirf(source, &filesize) == -1) {
@@ -587,62 +1322,125 @@ char *source, *dest;
 		rc = -1;
 	}
 	else {
-		/* BEWARE: assumes file size < 8 meg */
-		nblocks = filesize/BUFFSIZE;
-		nbytes = filesize % BUFFSIZE;
-		
+		/* with -R a partial local copy is added to; CP/M
+		** files are whole records, all of them good.
+		*/
+		start = 0L;
+		if (f_resume)
+			start = cfsize(dest);
+		if ((start > 0L) && (start >= filesize)) {
+			printf("%s already copied\n", dest);
+			return 0;
+		}
+
 		/* open source file on flash device for read */
 		if (vropen(source) == -1) {
 			printf("Unable to open source file %s\n", source);
 			rc = -1;
 		}
-		else if	((channel = fopen(dest, "wb")) == 0) {
-			printf("\nError opening destination file %s\n", dest);
-			rc = -1;
-		}
 		else {
-			printf("%s --> %s\n", source, dest);
-			/* copy one block at a time */
-			for (done = FALSE, i=1; ((i<=nblocks) && (!done)); i++) {
-				/* read a block from input file */
-				if (vread(rwbuffer, BUFFSIZE) == -1) {
-					printf("\nError reading block %d\n", i);
-					done = TRUE;
+			/* a single RDF streams the whole file; it is sent
+			** first so the VDIP fills its FIFO while CP/M
+			** creates the local file.
+			*/
+			t0 = vticks();
+			if ((start > 0L) && (vlseek(start) == -1)) {
+				printf("Unable to seek in %s\n", source);
+				vclose(source);
+				return -1;
+			}
+			if (filesize > start)
+				vrdstart(filesize - start);
+		
+			/* a partial copy is opened and positioned at its
+			** end, otherwise a new file is made
+			*/
+			ul.l = start / RECSIZE;
+			if (start > 0L) {
+				if ((cfopen(dest, fcb) == -1) || (cfseek(fcb, ul.i[0]) == -1))
 					rc = -1;
+			}
+			else if (cfmake(dest, fcb) == -1)
+				rc = -1;
+			if (rc == -1) {
+				printf("\nError opening destination file %s\n", dest);
+				/* discard the stream */
+				vrdend();
+				vclose(source);
+				return -1;
+			}
+			if (start > 0L)
+				printf("%s --> %s (from %ld)\n", source, dest, start);
+			else
+				printf("%s --> %s\n", source, dest);
+			prgset(filesize - start);
+
+			/* copy one buffer at a time: the FIFO bytes land
+			** straight in the buffer, which the BDOS writes
+			** in one call.  The last record is padded with ^Z.
+			** With a staging bank several buffers are taken
+			** from the FIFO first, then all written together.
+			*/
+			bsize = BUFFSIZE;
+			moved = 0L;
+			for (left=filesize-start, done=FALSE; (left > 0L) && !done; ) {
+				for (nb=0; (nb < (xbank ? XBNBUF : 1)) && (left > 0L); nb++) {
+					n = (left < bsize) ? left : BUFFSIZE;
+					left -= n;
+					
+					/* a stalled VDIP is reported by vrdend() */
+					if (vrdblk(rwbuffer, n) == -1) {
+						done = TRUE;
+						break;
+					}
+					if (xbank)
+						bmove(XBBASE + nb*BUFFSIZE, xbank,
+							rwbuffer, TPABANK, n);
 				}
-				else {
-					if ((write(channel, rwbuffer, BUFFSIZE)) == -1) {
+				last = n;
+				for (j=0; (j<nb) && !done; j++) {
+					/* all but the last are full */
+					n = (j < nb-1) ? BUFFSIZE : last;
+					if (xbank)
+						bmove(rwbuffer, TPABANK,
+							XBBASE + j*BUFFSIZE, xbank, n);
+					nrec = cfpad(rwbuffer, n);
+					if (cfwrite(fcb, rwbuffer, nrec) != nrec) {
 						printf("\nError writing to %s\n", dest);
 						rc = -1;
 						done = TRUE;
 					}
+					else
+						moved += n;
 					/* show user we're working ... */
-					putchar('.');
-					if ((i%60) == 0)
-						printf("\n");
+					prgadd(n);
 				}
 			}
-			/* NUL fill the buffer before last write */
-			for (i=0; i<BUFFSIZE; i++)
-				rwbuffer[i]=0;
-	
-			/* if any extra bytes process them ... */
-			if ((nbytes > 0) && !done) {
-				/* read final remaining bytes */
-				if (vread(rwbuffer, nbytes) == -1) {
-					printf("\nError reading final block\n");
-					rc = -1;
-				}
-				else if((write(channel, rwbuffer, BUFFSIZE)) == -1) {
-					printf("\nError writing to %s\n", dest);
-					rc = -1;
-				}
-			}	
-			printf("\n%ld bytes\n", filesize);
+			
+			/* collect the prompt that ends the stream; any
+			** bytes not read after an error are discarded.
+			*/
+			if ((filesize > start) && (vrdend() == -1)) {
+				printf("\nError reading %s\n", source);
+				rc = -1;
+			}
+			prgend();
+			printf("%ld bytes\n", moved);
+			t0 = vticks() - t0;
 
-			/* important - close files! */
-			fclose(channel);
-			vclose(source);
+			/* important - close files!  The VDIP closes its
+			** file while CP/M flushes the local one.
+			*/
+			vqclose(source);
+			if (cfclose(fcb) == -1) {
+				printf("Error closing %s\n", dest);
+				rc = -1;
+			}
+			if (vsettle() == -1) {
+				printf("Error closing %s\n", source);
+				rc = -1;
+			}
+			logrec("GET", source, moved, t0, BUFFSIZE, rc);
 		}
 	}
 	return rc;
@@ -655,13 +1453,22 @@ char *source, *dest;
 */
 listmatch()
 {
-	int i, j, nfiles;
+	int i, j, nfiles, d;
 	char *c;
 	static char fsize[15];
 	
 	nfiles = 0;
+	d = -1;
 	for (i=0; i<nentries; i++) {
 		if(direntry[i]->tag) {
+			/* with -S a heading for each subdirectory */
+			if (f_sub && (direntry[i]->sdir != d)) {
+				d = direntry[i]->sdir;
+				if (srctype == USBD)
+					printf("\nDirectory %s\n", sdpath(d));
+				else
+					printf("\nUser %d\n", sdusr[d]);
+			}
 			printf("%-8s", direntry[i]->name);
 			if (direntry[i]->isdir)
 				/* directory entry */
@@ -709,6 +1516,10 @@ copyfiles()
 	for (i=0, ncp=0; i<nentries; i++) {
 		/* copy tagged files (but not directories!) */
 		if(direntry[i]->tag && !direntry[i]->isdir) {
+			/* with -S go to its subdirectory and user area */
+			if (f_sub && (subgo(direntry[i]->sdir) == -1))
+				continue;
+			
 			/* get current time & date and save
 			** for use by vwopen() */
 			settd();
@@ -720,8 +1531,15 @@ copyfiles()
 				strcat(fullname,":");
 				strcat(fullname, srcfname);
 				dstexpand(direntry[i], &dstspec, dstfname);
-				if ((vcput(fullname, dstfname)) != -1);
+				if ((vcput(fullname, dstfname)) != -1)
 					++ncp;
+				else
+					/* resynchronize before the next command */
+					vsess = FALSE;
+				/* the USB directory has changed */
+				if (direntry[i]->sdir == 0)
+					uinval(dstfname);
+				catdel();
 			}
 			else if ((srctype == USBD) && (dsttype == STORD)){
 				fullname[0] = NUL;
@@ -731,9 +1549,17 @@ copyfiles()
 				strcat(fullname, dstfname);
 				if ((vcp(srcfname, fullname)) != -1)
 					++ncp;
+				else
+					/* resynchronize before the next command */
+					vsess = FALSE;
 			}
 		}
 	}
+	/* collect the last deferred close */
+	if (vsettle() == -1) {
+		printf("Error closing a file on the USB device\n");
+		vsess = FALSE;
+	}
 	printf("\n%d Files Copied\n", ncp);
 }
 
@@ -1019,32 +1845,74 @@ char *s;
 	/* do validation check on specified devices and set defaults */
 	rc = checkdev();
 	if (rc == 0) {
-		/* initialize VDIP */
-		if (vinit() == -1) {
-			rc = 5;
-			printf("Error initializing VDIP-1 device!\n");
-		}
-		/* make sure there's a drive inserted */
-		else if (vfind_disk() == -1) {
-			rc = 6;
-			printf("No flash drive found!\n");
+		/* a session kept from the last command is reused as
+		** long as the drive is still there; otherwise (first
+		** command, error or disk changed) start over.
+		*/
+		if (vsess && (vfind_disk() == -1))
+			vsess = FALSE;
+		if (!vsess) {
+			freeudir();
+			/* initialize VDIP */
+			if (vinit() == -1) {
+				rc = 5;
+				printf("Error initializing VDIP-1 device!\n");
+			}
+			/* make sure there's a drive inserted */
+			else if (vfind_disk() == -1) {
+				rc = 6;
+				printf("No flash drive found!\n");
+			}
+			else
+				vsess = TRUE;
 		}
-		else {
+		if (rc == 0) {
 			/* build directory and tag matching files */
 			if ((srctype == STORD) || (srctype == USBD)) {
 				/* first build the directory tree in memory */
-				if (srctype == STORD)
+				if (f_sub) {
+					/* all subdirectories or user areas */
+					sdinit();
+					if (srctype == STORD)
+						bldctree(srcdev);
+					else
+						bldutree();
+				}
+				else if (srctype == STORD)
 					bldcdir(srcdev);	/* CP/M */
 				else
 					bldudir();			/* USB */
 				/* now tag file entries that match any of the source filespecs */
 				for (i=0; i<nsrc; i++)
 					domatch(src[i]->fname, src[i]->fext);
+				
+				/* a listing shows USB size and date, so fetch
+				** them for the tagged entries; a copy gets the
+				** size as it opens each file.
+				*/
+				if ((srctype == USBD) && f_list && f_sub)
+					subdetail();
+				else if ((srctype == USBD) && f_sub)
+					/* a copy must not merge files */
+					subclash();
+				else if ((srctype == USBD) && f_list && !udetail()) {
+					if (catload(direntry, nentries) == 0)
+						for (i=0; i<nentries; i++)
+							direntry[i]->known = TRUE;
+					else {
+						printf("Cataloging USB file details...\n");
+						/* cache it only if it's complete */
+						if (vdir2())
+							catsave(direntry, nentries);
+					}
+				}
 			}
 			if (f_list)
 				listmatch();
 			else
 				copyfiles();
+			if (f_sub)
+				subdone();
 		}
 	}
 	else if (rc == 1)
@@ -1074,24 +1942,38 @@ char *argv[];
 	/* process any switches */
 	dosw(argc, argv);
 
-	printf("VPIP Ver. 3.2 (CP/M 3) - G. Roberts.  Using USB ports: %o,%o\n",
+	printf("VPIP Ver. 3.3 (CP/M 3) - G. Roberts.  Using USB ports: %o,%o\n",
 		p_data, p_stat);
 
     /* CP/M3 is required! */
 	if ((bdoshl(12,0) & 0xF0) != 0x30)
 		printf("CP/M Version 3 is required!\n");
-	else if (argc < 2) {
-		/* interactive mode	*/
-		do {
-			printf(":V:");
-			if ((l = getline(cmdline,80)) > 0) {
-				strupr(cmdline);
-				docmd(cmdline);
-				freeall();
-			}
-		} while (l > 0);
+	else {
+		/* check the staging bank before it is used */
+		if (xbank)
+			xbinit();
+		
+		if (tracing && (vtron() == -1))
+			printf("Command trace not available\n");
+		
+		if (argc < 2) {
+			/* interactive mode	*/
+			do {
+				printf(":V:");
+				if ((l = getline(cmdline,80)) > 0) {
+					strupr(cmdline);
+					docmd(cmdline);
+					freeall();
+				}
+			} while (l > 0);
+		}
+		else
+			/* command line mode */
+			docmd(argv[1]);
+		
+		if (logflush() == -1)
+			printf("Error writing the timing log\n");
+		if (tracing)
+			vtrdump();
 	}
-	else
-		/* command line mode */
-		docmd(argv[1]);
 }
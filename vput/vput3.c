@@ -12,15 +12,31 @@
 ** switches:
 **		-p<port>	to specify octal port (default is 0331)
 **		-v			"verbose" - continuous display of progress
+**		-c			compact (short command set) protocol
+**		-t			trace monitor commands, dump at exit (needs
+**					VINC built with VTRACE)
+**		-o<file>	append a CSV timing record for each file to
+**					a local file, or USB:<file> on the stick
+**		-r			resume: a file already on the stick but
+**					shorter than the source is taken to be an
+**					interrupted copy, and only the rest is sent
 **
 ** Version 1.5	- CP/M 3 release
 **
 ** Compiled with Software Toolworks C/80 V. 3.0.  Requires
-** the following modules/libraries: PIO, VUCPM3, FPRINT, FLIBRARY
+** the following modules/libraries: PIO, VINC, VUTIL, VPROG, VLOG,
+** VCAT, FPRINT, FLIBRARY
 **
 ** Glenn Roberts 27 May 2013
 **
 ** v1.5: CP/M 3 release 6/2/19 (gfr)
+** v1.6: Stream each file with a single WRF command; use the
+**		shared VINC and VUTIL libraries.  Read the source with
+**		multi-sector BDOS calls instead of stdio.  -V
+**		progress shown at most once a second, with rate and
+**		time left (VPROG), for files of any size.  -T
+**		command trace.  -O timing log (VLOG).  -R carries on
+**		from a partial copy on the stick.
 **
 */
 
@@ -39,8 +55,11 @@
 **
 *********************************************/
 
-/* buffer used for read/write */
-#define BUFFSIZE	256	/* buffer size used for read/write */
+/* buffer used for read/write: a whole number of CP/M
+** records, read from disk in one BDOS call
+*/
+#define RECSIZE		128
+#define BUFFSIZE	4096	/* buffer size used for read/write */
 char rwbuffer[BUFFSIZE];
 
 /* USB i/o ports */
@@ -48,6 +67,8 @@ int p_data;		/* USB data port */
 int p_stat;		/* USB status port */
 
 int verbose;	/* if TRUE then show progress updates */
+int tracing;	/* if TRUE dump the monitor command trace */
+int resume;		/* if TRUE carry on from partial copies */
 
 struct datime {
 	unsigned date;
@@ -55,9 +76,12 @@ struct datime {
 	char minute;
 } dt;
 
-
 /* declared in vutil library */
-extern char td_string[15];		/* time/date hex value */
+long cfsize();
+
+/* declared in vinc library */
+extern int vcompact;	/* TRUE for SCS/IPH protocol */
+long vticks();
 
 /*********************************************
 **
@@ -65,196 +89,65 @@ extern char td_string[15];		/* time/date hex value */
 **
 *********************************************/
 
-/* modays - return days in given month and year */
-modays(month, year)
-int month;
-int year;
-{
-	int days;
-	
-	switch(month)
-	{
-		/* 30 days hath september, april, june and november */
-		case 9:
-		case 4:
-		case 6:
-		case 11:
-			days = 30;
-			break;
-
-		case 2:
-			days = is_leap(year) ? 29 : 28;
-			break;
-
-		/* all the rest have 31! */
-		default:
-			days = 31;
-			break;
-	}
-	
-	return days;
-}
-
-/* return TRUE if year is a leap year */
-is_leap(year) {
-	return (((year%4==0)&&((year%100)!=0)) || ((year%400)==0));
-}
-
-/* takes a CP/M 3 day count (from directory entry) and
-** computes day, month and year based on definition that
-** 1/1/1978 is day 1.
-*/
-dodate(days, date)
-int days;
-int date[];
-{
-	int yyyy, dd, m, mm;
-	
-	yyyy = 1978;
-	dd = days;
-	
-	while ((dd>365) && ((dd!=366) || !is_leap(yyyy))) {
-		dd -= is_leap(yyyy) ? 366 : 365;
-		++yyyy;
-	}
-
-	/* have year & days in the year; convert to dd/mm/yyyy */
-	mm = 1;
-	while (dd > (m=modays(mm, yyyy))) {
-		dd -= m;
-		++mm;
-	}
-	date[0] = dd;
-	date[1] = mm;
-	date[2] = yyyy;
-}
-
-
-/* commafmt - create a string containing the representation
-** of a long with commas every third position.  caution:
-** len must be guaranteed big enough to hold any long.
-*/
-commafmt(n, s, len)
-long n;
-char *s;
-int len;
-{
-	char *p;
-	int i;
-
-	/* work backward from end of string */
-	p = s + len - 1;
-	*p = 0;
-
-	i = 0;
-	do {
-		if(((i % 3) == 0) && (i != 0))
-			*--p = ',';
-		*--p = '0' + (n % 10);
-		n /= 10;
-		i++;
-	} while(n != 0);
-
-	/* pad the front with blanks */
-	while (p != s)
-		*--p = ' ';
-}
-
-/* settd - reads time/date via BDOS and stores result in
-** hexadecimal ASCII global string td_string[] using format
-** desired by VDIP chip.  This is used by vwopen() to
-** set the date on the file.j
-**
-** updates global datastructure dt
-*/
-settd()
-{
-	int seconds;
-	static int mydate[3];	/* day, month, year */
-	static unsigned utime, udate;
-	
-	/* snapshot time */
-	seconds = bdoshl(105, &dt);
-		
-	/* convert day count to day, month, year */
-	dodate(dt.date, mydate);
-	
-	/* store time in td_string */
-	utime = (btod(seconds)/2) + 
-			(btod(dt.minute) << 5) + 
-			(btod(dt.hour) << 11);
-	udate = mydate[0] + 
-			(mydate[1] << 5) + 
-			((mydate[2]-1980)  << 9);
-				
-	td_string[0] = ' ';
-	td_string[1] = '$';
-	td_string[2] = '\0';
-
-	hexcat(td_string, udate >> 8);
-	hexcat(td_string, udate & 0xFF);
-	hexcat(td_string, utime >> 8);
-	hexcat(td_string, utime & 0xFF);	
-}
-
-
-/* hexcat - converts unsigned int i to a 2 byte hexadecimal
-** representation in upper case ASCII and the catenates 
-** that to the end of string s */
-hexcat(s, i)
-char *s;
-unsigned i;
-{
-	static char b[3];
-	unsigned n;
-	
-	n = (i & 0xFF) >> 4;
-	b[0] = (n < 10) ? '0'+n : 'A'+n-10;
-	n = i & 0xF;
-	b[1] = (n < 10) ? '0'+n : 'A'+n-10;
-	b[2] = '\0';
-	strcat(s, b);
-}
-
 /* vcput - copy from CP/M source file to VDIP dest file */
 vcput(source, dest)
 char *source, *dest;
 {
-	int i, nblocks, nbytes, channel, done, result, seconds;
-	char *l;
-	static char fcb[36];
-	static long filesize;
-	static long pctdone;
-	static long start, finish, ttime;
+	int nrec, done, seconds, rc;
+	unsigned recno;
+	static long filesize, from, usize, moved;
+	static long start, finish, ttime, t0;
 	static char fsize[15];
 	static char frate[7];
+	static char fcb[36];
 	
-	if((channel = fopen(source, "rb")) == 0)
+	if (cfopen(source, fcb) == -1)
 		printf("Unable to open source file %s\n", source);
 	else {
 		/* first set up the file date for vwopen() */
 		settd();
+		
+		/* get input file size, before the first VDIP command
+		** while the monitor may still be closing the last file
+		*/
+		filesize = cfsize(source);
+		
+		/* with -R a shorter file on the stick is carried on
+		** from its last whole record
+		*/
+		from = 0L;
+		if (resume && (vdirf(dest, &usize) == 0)) {
+			if (usize >= filesize) {
+				printf("%-12s  already copied\n", source);
+				cfclose(fcb);
+				return;
+			}
+			from = (usize / RECSIZE) * RECSIZE;
+		}
+		
 		if (vwopen(dest) == -1) {
 			printf("Unable to open destination file %s\n", dest);
-			fclose(channel);
+			cfclose(fcb);
 		}
 		else {
-			/* get input file size */
-			makfcb(source, fcb);
-			bdos(35,fcb);
-			l = (char *) &filesize;
-			for (i=33; i<36; i++)
-				*l++ = fcb[i];
-			*l = 0;
-			filesize *= 128L;
-			nblocks = (filesize+128L)/BUFFSIZE;
 			commafmt(filesize, fsize, 15);
 			printf("%-12s  %s bytes --> ", source, fsize);
 			if (verbose)
 				putchar('\n');
 		
-			/* start writing at beginning of file */
-			vseek(0);
+			/* start writing at beginning of file, or at the
+			** end of the partial copy; the local file is
+			** positioned to match
+			*/
+			recno = from / RECSIZE;
+			if ((vlseek(from) == -1) || (cfseek(fcb, recno) == -1)) {
+				printf("Unable to resume %s\n", dest);
+				vclose(dest);
+				cfclose(fcb);
+				return;
+			}
+			if (from > 0L)
+				printf("(from %ld) ", from);
 
 			/* snapshot time */
 			seconds = bdoshl(105, &dt);
@@ -263,24 +156,46 @@ char *source, *dest;
 					btod(dt.minute) * 60L + 
 					btod(seconds);
 
-			/* copy one block at a time */
+			/* a single WRF streams the whole file */
+			t0 = vticks();
+			if (filesize > from)
+				vwrstart(filesize - from);
+
+			/* copy one buffer at a time: the BDOS reads it
+			** in one call and it goes straight to the FIFO
+			*/
 			done = FALSE;
-			for (i=0; !done; i++) {
-				nbytes = read(channel, rwbuffer, BUFFSIZE);
-				if (nbytes == 0)
+			rc = 0;
+			moved = 0L;
+			prgset(filesize - from);
+			while (!done) {
+				nrec = cfread(fcb, rwbuffer, BUFFSIZE/RECSIZE);
+				if (nrec < BUFFSIZE/RECSIZE)
+					/* end of file */
+					done = TRUE;
+				if (nrec == 0)
+					;
+				/* a stalled VDIP is reported by vwrend() */
+				else if (vwrblk(rwbuffer, nrec*RECSIZE) == -1) {
+					rc = -1;
 					done = TRUE;
+				}
 				else {
-					result = vwrite(rwbuffer, nbytes);
-					if (result == -1) {
-						printf("Error writing to VDIP device\n");
-						done = TRUE;
-					} else if (verbose) {
+					moved += nrec*RECSIZE;
+					if (verbose)
 						/* show user we're working ... */
-						pctdone = 100L * i/nblocks;
-						printf("Percent done: %ld\r", pctdone);
-					}
+						prgadd(nrec*RECSIZE);
 				}
 			}
+
+			/* collect the prompt that ends the stream */
+			if ((filesize > from) && (vwrend() == -1)) {
+				printf("Error writing to VDIP device\n");
+				rc = -1;
+			}
+			if (verbose)
+				prgend();
+			logrec("PUT", dest, moved, vticks() - t0, BUFFSIZE, rc);
 		
 			/* done! snapshot time */
 			seconds = bdoshl(105, &dt);
@@ -294,30 +209,22 @@ char *source, *dest;
 			if (ttime == 0)
 				ttime = 1;
 
-			commafmt(filesize/ttime, frate, 7);
+			commafmt((filesize - from)/ttime, frate, 7);
 			printf("%-12s : %ld sec. (%s BPS)\n", dest, ttime, frate);
 
-			/* close input file */
-			fclose(channel);
+			/* important - close file on VDIP; the prompt is
+			** collected by the next command, so the monitor
+			** updates the flash drive while the local file is
+			** closed and the next one opened.
+			*/
+			vqclose(dest);
 
-			/* important - close file on VDIP */
-			vclose(dest);
+			/* close input file */
+			cfclose(fcb);
 		}
 	}
 }
 
-/* aotoi - convert octal s to int */
-aotoi(s)
-char s[];
-{
-  int i, n;
-	
-  n = 0;
-  for (i = 0; s[i] >= '0' && s[i] <= '7'; ++i)
-	n = 8 * n + s[i] - '0';
-  return(n);
-}
-
 /* process switches */
 dosw(argc, argv)
 int argc;
@@ -340,6 +247,18 @@ char *argv[];
 			case 'V':
 				verbose = TRUE;
 				break;
+			case 'C':
+				vcompact = TRUE;
+				break;
+			case 'T':
+				tracing = TRUE;
+				break;
+			case 'O':
+				logset(++s);
+				break;
+			case 'R':
+				resume = TRUE;
+				break;
 			default:
 			    printf("Invalid switch %c\n", *s);
 				break;
@@ -361,6 +280,8 @@ char *argv[];
 	p_stat = VSTAT;
 	
 	verbose = FALSE;
+	tracing = FALSE;
+	resume = FALSE;
 
 	/* first expand any wild cards in command line */
 	command(&argc, &argv);
@@ -368,7 +289,7 @@ char *argv[];
 	/* process any switches */
 	dosw(argc, argv);
 
-	printf("VPUT v1.5 (CP/M 3) - G. Roberts.  Using USB ports: %o,%o\n",
+	printf("VPUT v1.6 (CP/M 3) - G. Roberts.  Using USB ports: %o,%o\n",
 			p_data, p_stat);
 			
     /* CP/M3 is required! */
@@ -376,6 +297,8 @@ char *argv[];
 		printf("CP/M Version 3 is required!\n");
 	else if (argc < 2)
 		printf("Usage: vput <file1> ... <filen>\n");
+	else if (tracing && (vtron() == -1))
+		printf("Command trace not available\n");
 	else if (vinit() == -1)
 		printf("Error initializing VDIP-1 device!\n");
 	else if (vfind_disk() == -1)
@@ -394,5 +317,15 @@ char *argv[];
 				vcput(srcfile, dstfile);
 			}
 		}
+		/* collect the last deferred close */
+		if (vsettle() == -1)
+			printf("Error closing a file on the VDIP device\n");
+		if (logflush() == -1)
+			printf("Error writing the timing log\n");
+		/* USB directory has changed, drop the VDIR catalog */
+		catdel();
 	}
+	
+	if (tracing)
+		vtrdump();
 }